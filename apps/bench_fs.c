@@ -0,0 +1,504 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+#define bench_fs_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	bench_fs_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define die_perror(msg)			\
+do {							\
+	perror(msg);				\
+	exit(1);					\
+} while (0)
+
+/* Geometry of the scratch image: the largest fs_make.x supports (32 MiB) */
+#define BENCH_DATA_BLOCKS 8192
+
+#define SEQ_FILE_SIZE (16 * 1024 * 1024)
+#define SEQ_IO_SIZE (64 * 1024)
+#define RAND_READS 20000
+#define CHURN_ROUNDS 5000
+#define CHURN_LIVE_FILES 16
+#define CHURN_FILE_SIZE 1024
+#define APPEND_FILES 8
+#define APPEND_WRITES 20000
+#define APPEND_SIZE 100
+#define DIR_FULL_ROUNDS 20
+
+/* Options */
+static const char *diskname;
+static const char *mkfs = "./fs_mkfs.x";
+static int use_mmap;
+static int json;
+static unsigned int scale = 1;
+
+/* Measurements of one workload */
+struct result {
+	const char *name;
+	size_t ops;
+	size_t bytes;
+	uint64_t start;	// when the measured part of the workload started
+	double seconds;	// wall-clock time of the measured part
+	uint64_t *lat;	// latency of each operation, in nanoseconds
+	size_t cap;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Start the measured part of workload @r, after its preparation */
+static void begin(struct result *r)
+{
+	r->start = now_ns();
+}
+
+/* Record an operation of @r started at @start, which moved @bytes bytes */
+static void record(struct result *r, uint64_t start, size_t bytes)
+{
+	uint64_t lat = now_ns() - start;
+
+	if (r->ops == r->cap) {
+		r->cap = r->cap ? 2 * r->cap : 1024;
+		r->lat = realloc(r->lat, r->cap * sizeof(*r->lat));
+		if (!r->lat)
+			die_perror("realloc");
+	}
+	r->lat[r->ops++] = lat;
+	r->bytes += bytes;
+}
+
+/* Format the scratch image with the external formatter, and mount it */
+static void setup(void)
+{
+	char blocks[16];
+	int status;
+	pid_t pid;
+
+	snprintf(blocks, sizeof(blocks), "%d", BENCH_DATA_BLOCKS);
+
+	pid = fork();
+	if (pid < 0)
+		die_perror("fork");
+	if (!pid) {
+		int null = open("/dev/null", O_WRONLY);
+
+		/* Keep the report (e.g., JSON) clean */
+		if (null >= 0)
+			dup2(null, STDOUT_FILENO);
+		execl(mkfs, mkfs, diskname, blocks, (char *)NULL);
+		perror(mkfs);
+		_exit(127);
+	}
+	if (waitpid(pid, &status, 0) < 0)
+		die_perror("waitpid");
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		die("Cannot format '%s' with '%s'", diskname, mkfs);
+
+	if ((use_mmap ? fs_mount_mmap(diskname) : fs_mount(diskname)))
+		die("Cannot mount diskname");
+}
+
+static void teardown(void)
+{
+	if (fs_umount())
+		die("Cannot unmount diskname");
+}
+
+/* Unmount and mount the image again, so that nothing is cached */
+static void remount(void)
+{
+	teardown();
+	if ((use_mmap ? fs_mount_mmap(diskname) : fs_mount(diskname)))
+		die("Cannot mount diskname");
+}
+
+static int open_new(const char *filename)
+{
+	int fd;
+
+	if (fs_create(filename))
+		die("Cannot create file '%s'", filename);
+	fd = fs_open(filename);
+	if (fd < 0)
+		die("Cannot open file '%s'", filename);
+	return fd;
+}
+
+/* Fill file @fd with @size bytes, in requests of SEQ_IO_SIZE bytes */
+static void fill(int fd, char *buf, size_t size, struct result *r)
+{
+	for (size_t done = 0; done < size; done += SEQ_IO_SIZE) {
+		uint64_t start = now_ns();
+
+		if (fs_write(fd, buf, SEQ_IO_SIZE) != SEQ_IO_SIZE)
+			die("Cannot write file");
+		if (r)
+			record(r, start, SEQ_IO_SIZE);
+	}
+}
+
+static void bench_seq_write(struct result *r)
+{
+	char *buf = malloc(SEQ_IO_SIZE);
+	int fd;
+
+	if (!buf)
+		die_perror("malloc");
+	memset(buf, 0xa5, SEQ_IO_SIZE);
+
+	begin(r);
+	fd = open_new("seq");
+	fill(fd, buf, SEQ_FILE_SIZE, r);
+	/* Count the write-back as well */
+	if (fs_close(fd) || fs_sync())
+		die("Cannot sync file");
+
+	free(buf);
+}
+
+static void bench_seq_read(struct result *r)
+{
+	char *buf = malloc(SEQ_IO_SIZE);
+	int fd;
+
+	if (!buf)
+		die_perror("malloc");
+
+	fd = open_new("seq");
+	fill(fd, buf, SEQ_FILE_SIZE, NULL);
+	fs_close(fd);
+	remount();
+
+	begin(r);
+	fd = fs_open("seq");
+	if (fd < 0)
+		die("Cannot open file");
+	for (size_t done = 0; done < SEQ_FILE_SIZE; done += SEQ_IO_SIZE) {
+		uint64_t start = now_ns();
+
+		if (fs_read(fd, buf, SEQ_IO_SIZE) != SEQ_IO_SIZE)
+			die("Cannot read file");
+		record(r, start, SEQ_IO_SIZE);
+	}
+	fs_close(fd);
+
+	free(buf);
+}
+
+/* Random reads of @size bytes, at offsets aligned on @size */
+static void rand_read(struct result *r, size_t size)
+{
+	char *buf = malloc(SEQ_IO_SIZE);
+	size_t slots = SEQ_FILE_SIZE / size;
+	int fd;
+
+	if (!buf)
+		die_perror("malloc");
+
+	fd = open_new("rand");
+	fill(fd, buf, SEQ_FILE_SIZE, NULL);
+
+	srand(150);
+	begin(r);
+	for (size_t i = 0; i < RAND_READS * scale; i++) {
+		size_t offset = (size_t)rand() % slots * size;
+		uint64_t start = now_ns();
+
+		if (fs_pread(fd, buf, size, offset) != (int)size)
+			die("Cannot read file");
+		record(r, start, size);
+	}
+	fs_close(fd);
+
+	free(buf);
+}
+
+static void bench_rand_read_512(struct result *r)
+{
+	rand_read(r, 512);
+}
+
+static void bench_rand_read_4k(struct result *r)
+{
+	rand_read(r, 4096);
+}
+
+/* Small files created, written, closed and deleted, with a few kept alive */
+static void bench_churn(struct result *r)
+{
+	char buf[CHURN_FILE_SIZE];
+	char filename[FS_FILENAME_LEN];
+
+	memset(buf, 'c', sizeof(buf));
+	begin(r);
+
+	for (size_t i = 0; i < CHURN_ROUNDS * scale; i++) {
+		uint64_t start = now_ns();
+		int fd;
+
+		/* Keep CHURN_LIVE_FILES files around, the oldest one goes */
+		if (i >= CHURN_LIVE_FILES) {
+			snprintf(filename, sizeof(filename), "churn%zu",
+				 i - CHURN_LIVE_FILES);
+			if (fs_delete(filename))
+				die("Cannot delete file '%s'", filename);
+		}
+
+		snprintf(filename, sizeof(filename), "churn%zu", i);
+		fd = open_new(filename);
+		if (fs_write(fd, buf, sizeof(buf)) != sizeof(buf))
+			die("Cannot write file");
+		fs_close(fd);
+		record(r, start, sizeof(buf));
+	}
+}
+
+/* Small appends spread over a few files, whose blocks end up interleaved */
+static void bench_append(struct result *r)
+{
+	char buf[APPEND_SIZE];
+	char filename[FS_FILENAME_LEN];
+	int fds[APPEND_FILES];
+
+	memset(buf, 'a', sizeof(buf));
+	begin(r);
+
+	for (size_t i = 0; i < APPEND_FILES; i++) {
+		snprintf(filename, sizeof(filename), "append%zu", i);
+		fds[i] = open_new(filename);
+	}
+
+	for (size_t i = 0; i < APPEND_WRITES * scale; i++) {
+		uint64_t start = now_ns();
+
+		if (fs_write(fds[i % APPEND_FILES], buf, sizeof(buf))
+		    != sizeof(buf))
+			die("Cannot write file");
+		record(r, start, sizeof(buf));
+	}
+
+	for (size_t i = 0; i < APPEND_FILES; i++)
+		fs_close(fds[i]);
+}
+
+/*
+ * Fill the root directory, look up each file and fail to create one more, then
+ * empty it again
+ */
+static void bench_dir_full(struct result *r)
+{
+	char filename[FS_FILENAME_LEN];
+
+	begin(r);
+	for (size_t round = 0; round < DIR_FULL_ROUNDS * scale; round++) {
+		uint64_t start;
+		int fd;
+
+		for (size_t i = 0; i < FS_FILE_MAX_COUNT; i++) {
+			snprintf(filename, sizeof(filename), "full%zu", i);
+			start = now_ns();
+			if (fs_create(filename))
+				die("Cannot create file '%s'", filename);
+			record(r, start, 0);
+		}
+
+		start = now_ns();
+		if (!fs_create("overflow"))
+			die("Created a file in a full directory");
+		record(r, start, 0);
+
+		for (size_t i = 0; i < FS_FILE_MAX_COUNT; i++) {
+			snprintf(filename, sizeof(filename), "full%zu", i);
+			start = now_ns();
+			fd = fs_open(filename);
+			if (fd < 0 || fs_close(fd))
+				die("Cannot open file '%s'", filename);
+			record(r, start, 0);
+		}
+
+		for (size_t i = 0; i < FS_FILE_MAX_COUNT; i++) {
+			snprintf(filename, sizeof(filename), "full%zu", i);
+			start = now_ns();
+			if (fs_delete(filename))
+				die("Cannot delete file '%s'", filename);
+			record(r, start, 0);
+		}
+	}
+}
+
+static struct {
+	const char *name;
+	void (*func)(struct result *);
+} benches[] = {
+	{ "seq_write",		bench_seq_write },
+	{ "seq_read",		bench_seq_read },
+	{ "rand_read_512",	bench_rand_read_512 },
+	{ "rand_read_4k",	bench_rand_read_4k },
+	{ "churn",		bench_churn },
+	{ "append",		bench_append },
+	{ "dir_full",		bench_dir_full },
+};
+
+static int cmp_lat(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile @p of the sorted latencies of @r, in microseconds */
+static double percentile(struct result *r, double p)
+{
+	size_t rank = (size_t)(p * r->ops + 0.999999);
+
+	if (!r->ops)
+		return 0;
+	if (rank < 1)
+		rank = 1;
+	if (rank > r->ops)
+		rank = r->ops;
+	return r->lat[rank - 1] / 1000.0;
+}
+
+static void report(struct result *r, int first)
+{
+	double mbps = r->bytes / r->seconds / (1024 * 1024);
+	double opss = r->ops / r->seconds;
+
+	qsort(r->lat, r->ops, sizeof(*r->lat), cmp_lat);
+
+	if (json) {
+		printf("%s\n    {\"name\": \"%s\", \"ops\": %zu, \"bytes\": %zu, "
+		       "\"seconds\": %.6f, \"mb_per_s\": %.2f, "
+		       "\"ops_per_s\": %.1f, \"p50_us\": %.2f, "
+		       "\"p99_us\": %.2f, \"p999_us\": %.2f}",
+		       first ? "" : ",", r->name, r->ops, r->bytes, r->seconds,
+		       mbps, opss, percentile(r, 0.5), percentile(r, 0.99),
+		       percentile(r, 0.999));
+		return;
+	}
+
+	printf("%-14s %9zu %10.2f %12.1f %10.2f %10.2f %10.2f\n", r->name,
+	       r->ops, mbps, opss, percentile(r, 0.5), percentile(r, 0.99),
+	       percentile(r, 0.999));
+}
+
+static void usage(char *program)
+{
+	fprintf(stderr, "Usage: %s [-j] [-M] [-c <cache blocks>] "
+		"[-n <scale>] [-f <formatter>] <scratch disk> [<workload>...]\n",
+		program);
+	fprintf(stderr, "\t-j\tJSON output\n");
+	fprintf(stderr, "\t-M\tmount the disk with fs_mount_mmap()\n");
+	fprintf(stderr, "\t-c\tblock cache size, in blocks\n");
+	fprintf(stderr, "\t-n\tmultiply the number of operations\n");
+	fprintf(stderr, "\t-f\tformatter program (default %s)\n", mkfs);
+	fprintf(stderr, "The scratch disk is formatted before each workload. "
+		"Possible workloads are:\n");
+	for (size_t i = 0; i < ARRAY_SIZE(benches); i++)
+		fprintf(stderr, "\t%s\n", benches[i].name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	long cache_blocks = -1;
+	int first = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "jMc:n:f:")) != -1) {
+		switch (opt) {
+		case 'j':
+			json = 1;
+			break;
+		case 'M':
+			use_mmap = 1;
+			break;
+		case 'c':
+			cache_blocks = strtol(optarg, NULL, 0);
+			if (cache_blocks < 0 || cache_blocks == LONG_MAX)
+				usage(argv[0]);
+			break;
+		case 'n':
+			scale = strtoul(optarg, NULL, 0);
+			if (!scale)
+				usage(argv[0]);
+			break;
+		case 'f':
+			mkfs = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind >= argc)
+		usage(argv[0]);
+	diskname = argv[optind++];
+
+	for (int j = optind; j < argc; j++) {
+		size_t i = 0;
+
+		while (i < ARRAY_SIZE(benches) && strcmp(argv[j], benches[i].name))
+			i++;
+		if (i == ARRAY_SIZE(benches)) {
+			bench_fs_error("invalid workload '%s'", argv[j]);
+			usage(argv[0]);
+		}
+	}
+
+	if (cache_blocks >= 0 && fs_cache_config(cache_blocks))
+		die("Cannot configure the block cache");
+
+	if (json)
+		printf("{\n  \"disk_blocks\": %d, \"mmap\": %s, \"scale\": %u,"
+		       "\n  \"results\": [", BENCH_DATA_BLOCKS,
+		       use_mmap ? "true" : "false", scale);
+	else
+		printf("%-14s %9s %10s %12s %10s %10s %10s\n", "workload", "ops",
+		       "MB/s", "ops/s", "p50 us", "p99 us", "p999 us");
+
+	for (size_t i = 0; i < ARRAY_SIZE(benches); i++) {
+		struct result r = { .name = benches[i].name };
+		int selected = optind == argc;
+
+		for (int j = optind; j < argc; j++)
+			selected |= !strcmp(argv[j], benches[i].name);
+		if (!selected)
+			continue;
+
+		setup();
+		benches[i].func(&r);
+		r.seconds = (now_ns() - r.start) / 1e9;
+		teardown();
+
+		report(&r, first);
+		first = 0;
+		free(r.lat);
+	}
+
+	if (json)
+		printf("\n  ]\n}\n");
+
+	return 0;
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+#define fs_mkfs_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	fs_mkfs_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+/* Largest data block count that keeps every block index within 16 bits */
+#define MAX_DATA_BLOCKS 65501
+
+static void usage(char *program)
+{
+	fprintf(stderr, "Usage: %s [-s] [-j <journal blocks>] "
+		"[-i <index blocks>] <diskname> <data block count>\n", program);
+	fprintf(stderr, "\t-s\tsparse image, data blocks are not allocated "
+		"on the host\n");
+	fprintf(stderr, "\t-j\treserve a journal region (see fs_journal_create())\n");
+	fprintf(stderr, "\t-i\treserve an index region\n");
+	exit(1);
+}
+
+static size_t get_count(char *program, const char *arg)
+{
+	char *end;
+	long n = strtol(arg, &end, 0);
+
+	if (*arg == '\0' || *end != '\0' || n < 0)
+		usage(program);
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	size_t data_blocks, journal_blocks = 0, index_blocks = 0;
+	int flags = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "sj:i:")) != -1) {
+		switch (opt) {
+		case 's':
+			flags |= FS_FORMAT_SPARSE;
+			break;
+		case 'j':
+			journal_blocks = get_count(argv[0], optarg);
+			break;
+		case 'i':
+			index_blocks = get_count(argv[0], optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2)
+		usage(argv[0]);
+
+	data_blocks = get_count(argv[0], argv[optind + 1]);
+	if (!data_blocks || data_blocks > MAX_DATA_BLOCKS)
+		die("data block count invalid, range is [1, %d]",
+		    MAX_DATA_BLOCKS);
+
+	if (fs_format(argv[optind], data_blocks, journal_blocks, index_blocks,
+		      flags))
+		die("Cannot format '%s'", argv[optind]);
+
+	printf("Created virtual disk '%s' with '%zu' data blocks\n",
+	       argv[optind], data_blocks);
+
+	return 0;
+}
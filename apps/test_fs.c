@@ -1,12 +1,15 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <fs.h>
@@ -34,6 +37,84 @@ struct thread_arg {
 	char **argv;
 };
 
+/* Whether scripts print the file system statistics before unmounting */
+static int script_stats;
+
+/* Trace file recording the first mount of a script, if not NULL */
+static const char *script_trace;
+
+static const char *stats_op_names[FS_STATS_OPS] = {
+	[FS_STATS_CREATE] = "create",
+	[FS_STATS_DELETE] = "delete",
+	[FS_STATS_OPEN] = "open",
+	[FS_STATS_CLOSE] = "close",
+	[FS_STATS_FSYNC] = "fsync",
+	[FS_STATS_STAT] = "stat",
+	[FS_STATS_LSEEK] = "lseek",
+	[FS_STATS_READ] = "read",
+	[FS_STATS_WRITE] = "write",
+	[FS_STATS_PREAD] = "pread",
+	[FS_STATS_PWRITE] = "pwrite",
+	[FS_STATS_RESERVE] = "reserve",
+	[FS_STATS_READ_MAP] = "read_map",
+	[FS_STATS_COPY_TO_FD] = "copy_to_fd",
+	[FS_STATS_COPY_FROM_FD] = "copy_from_fd",
+	[FS_STATS_SYNC] = "sync",
+	[FS_STATS_READ_UNMAP] = "read_unmap",
+	[FS_STATS_READ_ASYNC] = "read_async",
+	[FS_STATS_WRITE_ASYNC] = "write_async",
+	[FS_STATS_ASYNC_WAIT] = "async_wait",
+};
+
+/* Upper bound of the latency of @p of the calls of @lat, in nanoseconds */
+static size_t stats_percentile(struct fs_stats_latency *lat, double p)
+{
+	size_t seen = 0;
+	int i;
+
+	for (i = 0; i < FS_STATS_BUCKETS - 1; i++) {
+		seen += lat->buckets[i];
+		if (seen >= p * lat->calls)
+			break;
+	}
+	return (size_t)2 << i;
+}
+
+static void print_stats(void)
+{
+	struct fs_stats st;
+
+	if (fs_stats(&st))
+		die("Cannot get statistics");
+	if (!st.enabled) {
+		printf("Statistics not available (libfs built with STATS=0)\n");
+		return;
+	}
+
+	printf("block_reads=%zu\n", st.block_reads);
+	printf("block_writes=%zu\n", st.block_writes);
+	printf("bytes_read=%zu\n", st.bytes_read);
+	printf("bytes_written=%zu\n", st.bytes_written);
+	printf("fat_hops=%zu\n", st.fat_hops);
+	printf("dir_lookups=%zu\n", st.dir_lookups);
+	printf("allocations=%zu\n", st.allocations);
+	printf("blocks_allocated=%zu\n", st.blocks_allocated);
+	printf("bounce_copies=%zu\n", st.bounce_copies);
+	printf("bounce_bytes=%zu\n", st.bounce_bytes);
+
+	printf("%-13s %8s %10s %10s %10s\n", "call", "calls", "avg ns",
+	       "p50 ns <", "p99 ns <");
+	for (int op = 0; op < FS_STATS_OPS; op++) {
+		struct fs_stats_latency *lat = &st.ops[op];
+
+		if (!lat->calls)
+			continue;
+		printf("%-13s %8zu %10zu %10zu %10zu\n", stats_op_names[op],
+		       lat->calls, lat->total_ns / lat->calls,
+		       stats_percentile(lat, 0.5), stats_percentile(lat, 0.99));
+	}
+}
+
 void thread_fs_script(void *arg)
 {
 	struct thread_arg *t_arg = arg;
@@ -94,7 +175,17 @@ void thread_fs_script(void *arg)
 				mounted = 1;
 			}
 
+			if (script_trace) {
+				if (fs_trace_start(script_trace)) {
+					fs_umount();
+					die("Cannot record trace");
+				}
+				script_trace = NULL;
+			}
+
 		} else if (strcmp(command, "UMOUNT") == 0) {
+			if (mounted && script_stats)
+				print_stats();
 			if (mounted && fs_umount())
 				die("Cannot unmount");
 			else {
@@ -263,6 +354,8 @@ void thread_fs_script(void *arg)
 
 	/* unmount at the end just to be safe in case there is
 	   no UMOUNT command in script */
+	if (mounted && script_stats)
+		print_stats();
 	if (mounted && fs_umount())
 		die("Cannot unmount diskname");
 
@@ -507,6 +600,698 @@ size_t get_argv(char *argv)
 	return (size_t)ret;
 }
 
+void thread_fs_journal(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname;
+	size_t nr_blocks;
+
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <journal blocks>");
+
+	diskname = t_arg->argv[0];
+	nr_blocks = get_argv(t_arg->argv[1]);
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	if (fs_journal_create(nr_blocks)) {
+		fs_umount();
+		die("Cannot create journal");
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Created journal (%zu blocks)\n", nr_blocks);
+}
+
+void thread_fs_stats(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <script filename>");
+
+	/* Run the script, with statistics before each unmount */
+	script_stats = 1;
+	thread_fs_script(arg);
+}
+
+void thread_fs_record(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+
+	if (t_arg->argc < 3)
+		die("Usage: <diskname> <script filename> <trace filename>");
+
+	/* Run the script, recording its calls once the disk is mounted */
+	script_trace = t_arg->argv[2];
+	thread_fs_script(arg);
+}
+
+/* Replayed calls of one kind */
+struct replay_op {
+	size_t calls;
+	size_t total_ns;
+};
+
+static size_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (size_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_size(const void *a, const void *b)
+{
+	size_t x = *(const size_t *)a, y = *(const size_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Mapping held by the replay until the trace releases it */
+struct replay_map {
+	int fd;
+	size_t bytes;
+	struct iovec *iov;
+	int iovcnt;
+};
+
+/* Bytes transferred by the asynchronous requests of the replay */
+static size_t replay_async_bytes;
+
+static void replay_async_done(int fd, int ret, void *arg)
+{
+	if (ret > 0)
+		__atomic_fetch_add(&replay_async_bytes, ret, __ATOMIC_RELAXED);
+}
+
+void thread_fs_replay(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *tracename;
+	FILE *trace;
+	struct fs_trace_header header;
+	struct fs_trace_record rec;
+	struct replay_op ops[FS_STATS_OPS] = { 0 };
+	int fds[FS_OPEN_MAX_COUNT];
+	char opened[FS_OPEN_MAX_COUNT] = { 0 };
+	char name[UINT8_MAX + 1];
+	struct replay_map *maps = NULL;
+	size_t nmaps = 0, maps_size = 0;
+	char *buf = NULL;
+	size_t buf_size = 0;
+	size_t *lat = NULL;
+	size_t nlat = 0, lat_size = 0;
+	size_t bytes = 0, mismatches = 0;
+	size_t start, elapsed;
+	int paced, unmap_now, null_fd, zero_fd;
+
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <trace filename> [paced]");
+
+	diskname = t_arg->argv[0];
+	tracename = t_arg->argv[1];
+	paced = t_arg->argc > 2 && !strcmp(t_arg->argv[2], "paced");
+
+	trace = fopen(tracename, "r");
+	if (!trace)
+		die_perror("fopen");
+	if (fread(&header, sizeof(header), 1, trace) != 1
+	    || memcmp(header.signature, FS_TRACE_SIGNATURE, 8)
+	    || header.version < 1 || header.version > FS_TRACE_VERSION)
+		die("Not a trace file: %s", tracename);
+
+	/* Version 1 traces do not record when mappings are released */
+	unmap_now = header.version == 1;
+
+	/* Data is not recorded: reads and copies go nowhere, writes send zeros */
+	null_fd = open("/dev/null", O_WRONLY);
+	zero_fd = open("/dev/zero", O_RDONLY);
+	if (null_fd < 0 || zero_fd < 0)
+		die_perror("open");
+
+	for (int i = 0; i < FS_OPEN_MAX_COUNT; i++)
+		fds[i] = -1;
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	start = now_ns();
+	while (fread(&rec, sizeof(rec), 1, trace) == 1) {
+		struct iovec *iov;
+		int iovcnt;
+		size_t t;
+		int fd, ret;
+
+		if (rec.op >= FS_STATS_OPS
+		    || fread(name, 1, rec.name_len, trace) != rec.name_len) {
+			fs_umount();
+			die("Corrupted trace file: %s", tracename);
+		}
+		name[rec.name_len] = '\0';
+
+		if (rec.count > buf_size) {
+			/* Asynchronous requests may still be using the buffer */
+			fs_async_wait();
+			buf_size = rec.count;
+			buf = realloc(buf, buf_size);
+			if (!buf)
+				die_perror("realloc");
+			memset(buf, 0, buf_size);
+		}
+
+		/* Recorded file descriptors map to the ones opened by the replay */
+		fd = rec.fd;
+		if (fd >= 0 && fd < FS_OPEN_MAX_COUNT)
+			fd = fds[fd];
+
+		/* At original pacing, wait until the call started in the trace */
+		if (paced) {
+			size_t now = now_ns();
+
+			if (now - start < rec.start_ns) {
+				struct timespec ts = {
+					(rec.start_ns - (now - start)) / 1000000000,
+					(rec.start_ns - (now - start)) % 1000000000
+				};
+				nanosleep(&ts, NULL);
+			}
+		}
+
+		t = now_ns();
+		switch (rec.op) {
+		case FS_STATS_CREATE:
+			ret = fs_create(name);
+			break;
+		case FS_STATS_DELETE:
+			ret = fs_delete(name);
+			break;
+		case FS_STATS_OPEN:
+			ret = fs_open(name);
+			break;
+		case FS_STATS_CLOSE:
+			ret = fs_close(fd);
+			break;
+		case FS_STATS_FSYNC:
+			ret = fs_fsync(fd);
+			break;
+		case FS_STATS_STAT:
+			ret = fs_stat(fd);
+			break;
+		case FS_STATS_LSEEK:
+			ret = fs_lseek(fd, rec.offset);
+			break;
+		case FS_STATS_READ:
+			ret = fs_read(fd, buf, rec.count);
+			break;
+		case FS_STATS_WRITE:
+			ret = fs_write(fd, buf, rec.count);
+			break;
+		case FS_STATS_PREAD:
+			ret = fs_pread(fd, buf, rec.count, rec.offset);
+			break;
+		case FS_STATS_PWRITE:
+			ret = fs_pwrite(fd, buf, rec.count, rec.offset);
+			break;
+		case FS_STATS_RESERVE:
+			ret = fs_reserve(fd, rec.count);
+			break;
+		case FS_STATS_READ_MAP:
+			ret = fs_read_map(fd, rec.offset, rec.count, &iov, &iovcnt);
+			if (ret < 0)
+				break;
+			if (unmap_now) {
+				fs_read_unmap(fd, iov, iovcnt);
+				break;
+			}
+			if (nmaps == maps_size) {
+				maps_size = maps_size ? 2 * maps_size : 16;
+				maps = realloc(maps, maps_size * sizeof(*maps));
+				if (!maps)
+					die_perror("realloc");
+			}
+			maps[nmaps++] = (struct replay_map){ fd, ret, iov, iovcnt };
+			break;
+		case FS_STATS_READ_UNMAP: {
+			/* Release the mapping of the same size, or the oldest one */
+			size_t i, found = nmaps;
+
+			for (i = 0; i < nmaps; i++) {
+				if (maps[i].fd != fd)
+					continue;
+				if (found == nmaps)
+					found = i;
+				if (maps[i].bytes == rec.count) {
+					found = i;
+					break;
+				}
+			}
+			ret = -1;
+			if (found < nmaps) {
+				ret = fs_read_unmap(fd, maps[found].iov,
+						    maps[found].iovcnt);
+				maps[found] = maps[--nmaps];
+			}
+			break;
+		}
+		case FS_STATS_READ_ASYNC:
+			ret = fs_read_async(fd, buf, rec.count,
+					    replay_async_done, NULL);
+			break;
+		case FS_STATS_WRITE_ASYNC:
+			ret = fs_write_async(fd, buf, rec.count,
+					     replay_async_done, NULL);
+			break;
+		case FS_STATS_ASYNC_WAIT:
+			ret = fs_async_wait();
+			break;
+		case FS_STATS_COPY_TO_FD:
+			ret = fs_copy_to_fd(fd, null_fd, rec.offset, rec.count);
+			break;
+		case FS_STATS_COPY_FROM_FD:
+			ret = fs_copy_from_fd(fd, zero_fd, rec.offset, rec.count);
+			break;
+		default:
+			ret = fs_sync();
+			break;
+		}
+		t = now_ns() - t;
+
+		if (rec.op == FS_STATS_OPEN) {
+			if (ret >= 0)
+				opened[ret] = 1;
+			if (ret >= 0 && rec.ret >= 0 && rec.ret < FS_OPEN_MAX_COUNT)
+				fds[rec.ret] = ret;
+			mismatches += (ret >= 0) != (rec.ret >= 0);
+		} else {
+			if (rec.op == FS_STATS_CLOSE && !ret) {
+				opened[fd] = 0;
+				if (rec.fd >= 0 && rec.fd < FS_OPEN_MAX_COUNT)
+					fds[rec.fd] = -1;
+			}
+			mismatches += ret != rec.ret;
+		}
+		if (rec.count && ret > 0)
+			bytes += ret;
+
+		ops[rec.op].calls++;
+		ops[rec.op].total_ns += t;
+		if (nlat == lat_size) {
+			lat_size = lat_size ? 2 * lat_size : 1024;
+			lat = realloc(lat, lat_size * sizeof(*lat));
+			if (!lat)
+				die_perror("realloc");
+		}
+		lat[nlat++] = t;
+	}
+	fs_async_wait();
+	elapsed = now_ns() - start;
+	bytes += replay_async_bytes;
+
+	/* Including the mappings and files left open, or opened only by the
+	 * replay */
+	for (size_t i = 0; i < nmaps; i++)
+		fs_read_unmap(maps[i].fd, maps[i].iov, maps[i].iovcnt);
+	for (int i = 0; i < FS_OPEN_MAX_COUNT; i++)
+		if (opened[i])
+			fs_close(i);
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	qsort(lat, nlat, sizeof(*lat), cmp_size);
+	printf("Replayed %zu calls in %.3f s%s\n", nlat, elapsed / 1e9,
+	       paced ? " (paced)" : "");
+	printf("calls/s=%.1f\n", nlat / (elapsed / 1e9));
+	printf("MB/s=%.2f\n", bytes / (elapsed / 1e9) / (1024 * 1024));
+	printf("mismatches=%zu\n", mismatches);
+	if (nlat)
+		printf("p50_ns=%zu\np99_ns=%zu\np999_ns=%zu\n",
+		       lat[(nlat - 1) / 2], lat[(nlat - 1) * 99 / 100],
+		       lat[(nlat - 1) * 999 / 1000]);
+
+	printf("%-13s %8s %10s\n", "call", "calls", "avg ns");
+	for (int op = 0; op < FS_STATS_OPS; op++)
+		if (ops[op].calls)
+			printf("%-13s %8zu %10zu\n", stats_op_names[op],
+			       ops[op].calls, ops[op].total_ns / ops[op].calls);
+
+	free(lat);
+	free(maps);
+	free(buf);
+	close(null_fd);
+	close(zero_fd);
+	fclose(trace);
+}
+
+/* Operations of the stress command, in the order of their weights */
+enum stress_op {
+	STRESS_CREATE,
+	STRESS_OPEN,
+	STRESS_READ,
+	STRESS_WRITE,
+	STRESS_SEEK,
+	STRESS_DELETE,
+	STRESS_OPS
+};
+
+static const char *stress_op_names[STRESS_OPS] = {
+	"create", "open", "read", "write", "seek", "delete"
+};
+
+/* Largest file size and transfer size of the stress command */
+#define STRESS_FILE_MAX (64 * 1024)
+#define STRESS_IO_MAX 8192
+
+/* Files of a stress worker per thread, at most */
+#define STRESS_FILES 4
+
+/* File of a stress worker, and the content it should have */
+struct stress_file {
+	char name[FS_FILENAME_LEN];
+	int exists;
+	int fd;		// -1 if not open
+	size_t offset;
+	size_t size;
+	char *shadow;	// STRESS_FILE_MAX bytes
+};
+
+/* Stress worker thread */
+struct stress_worker {
+	pthread_t thread;
+	int id;
+	unsigned int seed;
+	size_t ops;
+	const unsigned int *weights;
+	int nfiles;
+	struct stress_file files[STRESS_FILES];
+	/* Results, only counting the operations that made a call */
+	size_t calls;
+	size_t done[STRESS_OPS];
+	size_t bytes;
+	size_t errors;	// failed calls or data that does not match
+	size_t elapsed_ns;
+	size_t *lat;	// latency of each operation
+};
+
+/*
+ * Perform operation @op on file @file of worker @w. Return 0 if it does not
+ * apply to the file in its current state (e.g., reading a closed file).
+ */
+static int stress_one(struct stress_worker *w, enum stress_op op,
+		       struct stress_file *file)
+{
+	size_t len = 1 + rand_r(&w->seed) % STRESS_IO_MAX;
+	char buf[STRESS_IO_MAX];
+	int ret;
+
+	switch (op) {
+	case STRESS_CREATE:
+		if (file->exists)
+			return 0;
+		if (fs_create(file->name)) {
+			w->errors++;
+			break;
+		}
+		file->exists = 1;
+		file->size = 0;
+		break;
+	case STRESS_OPEN:
+		/* Open the file, or close it if it is open */
+		if (!file->exists)
+			return 0;
+		if (file->fd >= 0) {
+			w->errors += fs_close(file->fd) != 0;
+			file->fd = -1;
+			break;
+		}
+		file->fd = fs_open(file->name);
+		w->errors += file->fd < 0;
+		file->offset = 0;
+		break;
+	case STRESS_READ:
+		if (file->fd < 0)
+			return 0;
+		ret = fs_read(file->fd, buf, len);
+		if (file->offset + len > file->size)
+			len = file->size - file->offset;
+		if (ret != (int)len
+		    || memcmp(buf, file->shadow + file->offset, len)) {
+			w->errors++;
+			break;
+		}
+		file->offset += ret;
+		w->bytes += ret;
+		break;
+	case STRESS_WRITE:
+		if (file->fd < 0)
+			return 0;
+		if (file->offset + len > STRESS_FILE_MAX)
+			len = STRESS_FILE_MAX - file->offset;
+		for (size_t i = 0; i < len; i++)
+			buf[i] = rand_r(&w->seed);
+		ret = fs_write(file->fd, buf, len);
+		if (ret < 0) {
+			w->errors++;
+			break;
+		}
+		/* The disk may be full */
+		memcpy(file->shadow + file->offset, buf, ret);
+		file->offset += ret;
+		if (file->offset > file->size)
+			file->size = file->offset;
+		w->bytes += ret;
+		break;
+	case STRESS_SEEK:
+		if (file->fd < 0)
+			return 0;
+		file->offset = rand_r(&w->seed) % (file->size + 1);
+		w->errors += fs_lseek(file->fd, file->offset) != 0;
+		break;
+	default:
+		if (!file->exists)
+			return 0;
+		if (file->fd >= 0)
+			fs_close(file->fd);
+		file->fd = -1;
+		w->errors += fs_delete(file->name) != 0;
+		file->exists = 0;
+		break;
+	}
+
+	return 1;
+}
+
+static void *stress_main(void *arg)
+{
+	struct stress_worker *w = arg;
+	unsigned int total = 0;
+	size_t start = now_ns();
+
+	for (int op = 0; op < STRESS_OPS; op++)
+		total += w->weights[op];
+
+	for (size_t i = 0; i < w->ops; i++) {
+		unsigned int pick = rand_r(&w->seed) % total;
+		struct stress_file *file = &w->files[rand_r(&w->seed) % w->nfiles];
+		enum stress_op op = 0;
+		size_t t;
+
+		while (pick >= w->weights[op])
+			pick -= w->weights[op++];
+
+		t = now_ns();
+		if (!stress_one(w, op, file))
+			continue;
+		w->lat[w->calls++] = now_ns() - t;
+		w->done[op]++;
+	}
+
+	w->elapsed_ns = now_ns() - start;
+	return NULL;
+}
+
+/* Check the content of the files of @w against their shadow copies */
+static size_t stress_check(struct stress_worker *w, size_t *nfiles,
+			   size_t *bytes)
+{
+	static char buf[STRESS_FILE_MAX + 1];
+	size_t errors = 0;
+
+	for (int i = 0; i < w->nfiles; i++) {
+		struct stress_file *file = &w->files[i];
+		int fd;
+
+		if (!file->exists)
+			continue;
+
+		fd = fs_open(file->name);
+		if (fd < 0 || fs_stat(fd) != (int)file->size
+		    || fs_read(fd, buf, sizeof(buf)) != (int)file->size
+		    || memcmp(buf, file->shadow, file->size)) {
+			fprintf(stderr, "stress: '%s' is corrupted\n",
+				file->name);
+			errors++;
+		}
+		if (fd >= 0)
+			fs_close(fd);
+		(*nfiles)++;
+		*bytes += file->size;
+	}
+
+	return errors;
+}
+
+static void stress_report(const char *name, size_t ops, size_t bytes,
+			  size_t errors, size_t elapsed_ns, size_t *lat)
+{
+	double s = elapsed_ns / 1e9;
+
+	qsort(lat, ops, sizeof(*lat), cmp_size);
+	printf("%-9s %9zu %12.1f %9.2f %9zu %9zu %9zu %7zu\n", name, ops,
+	       ops / s, bytes / s / (1024 * 1024), ops ? lat[(ops - 1) / 2] : 0,
+	       ops ? lat[(ops - 1) * 99 / 100] : 0,
+	       ops ? lat[(ops - 1) * 999 / 1000] : 0, errors);
+}
+
+void thread_fs_stress(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	unsigned int weights[STRESS_OPS] = { 1, 2, 4, 4, 2, 1 };
+	struct stress_worker *workers;
+	char *diskname;
+	size_t nthreads, ops;
+	size_t total_calls = 0, total_bytes = 0, total_errors = 0;
+	size_t check_errors = 0;
+	size_t nfiles = 0, file_bytes = 0;
+	size_t *all_lat;
+	size_t start, elapsed;
+	char label[16];
+
+	if (t_arg->argc < 3)
+		die("Usage: <diskname> <threads> <iterations per thread> "
+		    "[<create>:<open>:<read>:<write>:<seek>:<delete> weights]");
+
+	diskname = t_arg->argv[0];
+	nthreads = get_argv(t_arg->argv[1]);
+	ops = get_argv(t_arg->argv[2]);
+	if (!nthreads || nthreads > FS_OPEN_MAX_COUNT)
+		die("Invalid number of threads, range is [1, %d]",
+		    FS_OPEN_MAX_COUNT);
+
+	if (t_arg->argc > 3) {
+		unsigned int total = 0;
+		char *p = t_arg->argv[3];
+
+		for (int op = 0; op < STRESS_OPS; op++) {
+			weights[op] = strtoul(p, &p, 0);
+			total += weights[op];
+			if (op < STRESS_OPS - 1 && *p++ != ':')
+				die("Invalid operation weights '%s'",
+				    t_arg->argv[3]);
+		}
+		if (!total)
+			die("Invalid operation weights '%s'", t_arg->argv[3]);
+	}
+
+	workers = calloc(nthreads, sizeof(*workers));
+	all_lat = malloc((nthreads * ops + 1) * sizeof(*all_lat));
+	if (!workers || !all_lat)
+		die_perror("malloc");
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	/* Each worker owns its files, so that their content is known */
+	for (size_t t = 0; t < nthreads; t++) {
+		struct stress_worker *w = &workers[t];
+
+		w->id = t;
+		w->seed = t + 1;
+		w->ops = ops;
+		w->weights = weights;
+		w->nfiles = FS_OPEN_MAX_COUNT / nthreads;
+		if (w->nfiles > STRESS_FILES)
+			w->nfiles = STRESS_FILES;
+		w->lat = all_lat + t * ops;
+		for (int i = 0; i < w->nfiles; i++) {
+			struct stress_file *file = &w->files[i];
+
+			snprintf(file->name, FS_FILENAME_LEN, "stress%zu_%d", t,
+				 i);
+			file->fd = -1;
+			file->shadow = malloc(STRESS_FILE_MAX);
+			if (!file->shadow)
+				die_perror("malloc");
+			/* Leftovers of a previous run */
+			fs_delete(file->name);
+		}
+	}
+
+	start = now_ns();
+	for (size_t t = 0; t < nthreads; t++)
+		if (pthread_create(&workers[t].thread, NULL, stress_main,
+				   &workers[t]))
+			die("Cannot create thread");
+	for (size_t t = 0; t < nthreads; t++)
+		pthread_join(workers[t].thread, NULL);
+	elapsed = now_ns() - start;
+
+	printf("%-9s %9s %12s %9s %9s %9s %9s %7s\n", "thread", "ops", "ops/s",
+	       "MB/s", "p50 ns", "p99 ns", "p999 ns", "errors");
+	for (size_t t = 0; t < nthreads; t++) {
+		struct stress_worker *w = &workers[t];
+
+		snprintf(label, sizeof(label), "%zu", t);
+		stress_report(label, w->calls, w->bytes, w->errors,
+			      w->elapsed_ns, w->lat);
+		/* Gather the latencies of all the workers */
+		memmove(all_lat + total_calls, w->lat,
+			w->calls * sizeof(*all_lat));
+		total_calls += w->calls;
+		total_bytes += w->bytes;
+		total_errors += w->errors;
+	}
+	stress_report("all", total_calls, total_bytes, total_errors, elapsed,
+		      all_lat);
+
+	printf("mix:");
+	for (int op = 0; op < STRESS_OPS; op++) {
+		size_t done = 0;
+
+		for (size_t t = 0; t < nthreads; t++)
+			done += workers[t].done[op];
+		printf(" %s=%zu", stress_op_names[op], done);
+	}
+	printf("\n");
+
+	/* Validation: the content must survive closing and remounting */
+	for (size_t t = 0; t < nthreads; t++)
+		for (int i = 0; i < workers[t].nfiles; i++)
+			if (workers[t].files[i].fd >= 0)
+				fs_close(workers[t].files[i].fd);
+	if (fs_umount() || fs_mount(diskname))
+		die("Cannot remount diskname");
+	for (size_t t = 0; t < nthreads; t++)
+		check_errors += stress_check(&workers[t], &nfiles, &file_bytes);
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("validation: %zu files, %zu bytes, %zu errors\n", nfiles,
+	       file_bytes, check_errors);
+
+	for (size_t t = 0; t < nthreads; t++)
+		for (int i = 0; i < workers[t].nfiles; i++)
+			free(workers[t].files[i].shadow);
+	free(all_lat);
+	free(workers);
+
+	if (total_errors || check_errors)
+		exit(1);
+}
+
 static struct {
 	const char *name;
 	void(*func)(void *);
@@ -517,7 +1302,12 @@ static struct {
 	{ "rm",		thread_fs_rm },
 	{ "cat",	thread_fs_cat },
 	{ "stat",	thread_fs_stat },
-	{ "script",	thread_fs_script }
+	{ "journal",	thread_fs_journal },
+	{ "script",	thread_fs_script },
+	{ "stats",	thread_fs_stats },
+	{ "record",	thread_fs_record },
+	{ "replay",	thread_fs_replay },
+	{ "stress",	thread_fs_stress }
 };
 
 void usage(char *program)
@@ -0,0 +1,447 @@
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* The kernel headers have their own idea of the block size */
+#undef BLOCK_SIZE
+
+#include "aio.h"
+#include "disk.h"
+
+#define aio_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/* Maximum number of worker threads of the fallback backend */
+#define AIO_MAX_THREADS 16
+
+/* Request description */
+struct request {
+	int write;
+	/* What is left to transfer, and where it goes on disk */
+	struct iovec iov;
+	off_t offset;
+	size_t block;
+	size_t count;
+	aio_callback_t callback;
+	void *arg;
+	/* Worker queue link */
+	struct request *next;
+};
+
+/* Submission and completion rings shared with the kernel */
+struct ring {
+	int fd;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+/* Asynchronous I/O engine instance description */
+struct aio {
+	struct disk *disk;
+	int fd;
+	/* Protects everything below, and the submission ring */
+	pthread_mutex_t lock;
+	/* Signaled when a request completes */
+	pthread_cond_t room;
+	unsigned int depth;
+	unsigned int inflight;
+	int stopping;
+	/* io_uring backend, ring.fd is -1 for the thread backend */
+	struct ring ring;
+	pthread_t reaper;
+	/* Signaled to stop the reaper */
+	int stop_fd;
+	/* Thread backend: queued requests, and the threads serving them */
+	struct request *head, *tail;
+	pthread_cond_t work;
+	pthread_t threads[AIO_MAX_THREADS];
+	unsigned int nthreads;
+};
+
+static void ring_release(struct ring *ring)
+{
+	if (ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_len && ring->cq_ptr != MAP_FAILED)
+		munmap(ring->cq_ptr, ring->cq_len);
+	if (ring->sq_ptr != MAP_FAILED)
+		munmap(ring->sq_ptr, ring->sq_len);
+	close(ring->fd);
+	ring->fd = -1;
+}
+
+static int ring_setup(struct ring *ring, unsigned int entries)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0)
+		return -1;
+
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_len = p.cq_off.cqes
+		       + p.cq_entries * sizeof(struct io_uring_cqe);
+	/* Both rings may live in a single mapping */
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_len > ring->sq_len)
+			ring->sq_len = ring->cq_len;
+		ring->cq_len = 0;
+	}
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd,
+			    IORING_OFF_SQ_RING);
+	ring->cq_ptr = ring->sq_ptr;
+	if (ring->cq_len)
+		ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ring->fd,
+				    IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED
+	    || ring->sqes == MAP_FAILED) {
+		perror("mmap");
+		ring_release(ring);
+		return -1;
+	}
+
+	sq = ring->sq_ptr;
+	cq = ring->cq_ptr;
+	ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+static int ring_enter(struct ring *ring, unsigned int to_submit,
+		      unsigned int min_complete, unsigned int flags)
+{
+	int ret;
+
+	do {
+		ret = syscall(__NR_io_uring_enter, ring->fd, to_submit,
+			      min_complete, flags, NULL, 0);
+	} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+	return ret;
+}
+
+/*
+ * Queue @req in the submission ring and submit it, with @aio->lock held.
+ * Return -1 if the kernel did not take the entry, which is then removed from
+ * the ring, so that the caller completes @req itself.
+ */
+static int ring_push(struct aio *aio, struct request *req)
+{
+	struct ring *ring = &aio->ring;
+	/* Only the kernel consumes the submission ring */
+	unsigned tail = *ring->sq_tail;
+	unsigned index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = req->write ? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe->fd = aio->fd;
+	sqe->addr = (uintptr_t)&req->iov;
+	sqe->len = 1;
+	sqe->off = req->offset;
+	sqe->user_data = (uintptr_t)req;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	if (ring_enter(ring, 1, 0, 0) == 1)
+		return 0;
+
+	/*
+	 * An entry the kernel did not consume would be picked up by the next
+	 * submission, after the caller gave up on it: take it back
+	 */
+	perror("io_uring_enter");
+	if (__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) != tail)
+		return 0;
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+	return -1;
+}
+
+/* Run the callback of @req, and make room for another request */
+static void complete(struct aio *aio, struct request *req, int ret)
+{
+	req->callback(req->arg, ret);
+	free(req);
+
+	pthread_mutex_lock(&aio->lock);
+	aio->inflight--;
+	pthread_cond_broadcast(&aio->room);
+	pthread_mutex_unlock(&aio->lock);
+}
+
+/* Handle the completion of a transfer of @res bytes (or error -@res) */
+static void ring_complete(struct aio *aio, struct request *req, int res)
+{
+	int ret = 0;
+
+	/* Taking the lock also orders this with the submission of @req */
+	pthread_mutex_lock(&aio->lock);
+	if (res == -EINTR || res == -EAGAIN) {
+		res = 0;
+	} else if (res < 0) {
+		aio_error("%s of blocks %zu+%zu: %s",
+			  req->write ? "write" : "read", req->block,
+			  req->count, strerror(-res));
+		ret = -1;
+	} else if (res == 0) {
+		aio_error("unexpected end of disk at offset %lld",
+			  (long long)req->offset);
+		ret = -1;
+	}
+
+	if (res > 0) {
+		req->iov.iov_base = (char *)req->iov.iov_base + res;
+		req->iov.iov_len -= res;
+		req->offset += res;
+	}
+
+	/* Short transfer: resubmit the rest, which keeps its slot */
+	if (!ret && req->iov.iov_len) {
+		if (ring_push(aio, req) == 0) {
+			pthread_mutex_unlock(&aio->lock);
+			return;
+		}
+		ret = -1;
+	}
+	pthread_mutex_unlock(&aio->lock);
+
+	complete(aio, req, ret);
+}
+
+static void *reaper_main(void *arg)
+{
+	struct aio *aio = arg;
+	struct ring *ring = &aio->ring;
+
+	for (;;) {
+		unsigned head = *ring->cq_head;
+		unsigned tail = __atomic_load_n(ring->cq_tail,
+						__ATOMIC_ACQUIRE);
+
+		/*
+		 * Wait for completions, or for aio_destroy(), which cannot
+		 * count on the submission ring to wake us up
+		 */
+		if (head == tail) {
+			struct pollfd fds[2] = {
+				{ .fd = ring->fd, .events = POLLIN },
+				{ .fd = aio->stop_fd, .events = POLLIN },
+			};
+
+			if (poll(fds, 2, -1) < 0 && errno != EINTR)
+				perror("poll");
+			/* Nothing is left in flight by then */
+			if (fds[1].revents & POLLIN)
+				return NULL;
+			continue;
+		}
+
+		while (head != tail) {
+			struct io_uring_cqe *cqe;
+			struct request *req;
+			int res;
+
+			cqe = &ring->cqes[head & *ring->cq_mask];
+			req = (struct request *)(uintptr_t)cqe->user_data;
+			res = cqe->res;
+
+			/* Give the entry back before resubmitting anything */
+			head++;
+			__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+			ring_complete(aio, req, res);
+		}
+	}
+}
+
+static void *worker_main(void *arg)
+{
+	struct aio *aio = arg;
+
+	for (;;) {
+		struct request *req;
+		int ret;
+
+		pthread_mutex_lock(&aio->lock);
+		while (!aio->head && !aio->stopping)
+			pthread_cond_wait(&aio->work, &aio->lock);
+		req = aio->head;
+		if (!req) {
+			pthread_mutex_unlock(&aio->lock);
+			return NULL;
+		}
+		aio->head = req->next;
+		if (!aio->head)
+			aio->tail = NULL;
+		pthread_mutex_unlock(&aio->lock);
+
+		if (req->write)
+			ret = disk_write_range(aio->disk, req->block,
+					       req->count, req->iov.iov_base);
+		else
+			ret = disk_read_range(aio->disk, req->block,
+					      req->count, req->iov.iov_base);
+		complete(aio, req, ret);
+	}
+}
+
+struct aio *aio_create(struct disk *disk, unsigned int depth, int flags)
+{
+	struct aio *aio;
+
+	if (!depth)
+		depth = 1;
+
+	aio = calloc(1, sizeof(*aio));
+	if (!aio)
+		return NULL;
+
+	aio->disk = disk;
+	aio->fd = disk_fd(disk);
+	aio->depth = depth;
+	aio->ring.fd = -1;
+	aio->stop_fd = -1;
+	pthread_mutex_init(&aio->lock, NULL);
+	pthread_cond_init(&aio->room, NULL);
+	pthread_cond_init(&aio->work, NULL);
+
+	if (!(flags & AIO_THREADS) && ring_setup(&aio->ring, depth) == 0) {
+		aio->stop_fd = eventfd(0, EFD_CLOEXEC);
+		if (aio->stop_fd >= 0
+		    && pthread_create(&aio->reaper, NULL, reaper_main, aio) == 0)
+			return aio;
+		if (aio->stop_fd >= 0)
+			close(aio->stop_fd);
+		aio->stop_fd = -1;
+		ring_release(&aio->ring);
+	}
+
+	/* Fall back to blocking transfers on worker threads */
+	aio->nthreads = depth < AIO_MAX_THREADS ? depth : AIO_MAX_THREADS;
+	for (unsigned int i = 0; i < aio->nthreads; i++) {
+		if (pthread_create(&aio->threads[i], NULL, worker_main, aio)) {
+			aio_error("cannot start worker thread");
+			aio->nthreads = i;
+			aio_destroy(aio);
+			return NULL;
+		}
+	}
+
+	return aio;
+}
+
+void aio_destroy(struct aio *aio)
+{
+	if (!aio)
+		return;
+
+	pthread_mutex_lock(&aio->lock);
+	while (aio->inflight)
+		pthread_cond_wait(&aio->room, &aio->lock);
+	aio->stopping = 1;
+	pthread_cond_broadcast(&aio->work);
+	pthread_mutex_unlock(&aio->lock);
+
+	if (aio->ring.fd >= 0) {
+		uint64_t one = 1;
+
+		/* Only fails if the counter overflows, i.e. was already set */
+		if (write(aio->stop_fd, &one, sizeof(one)) != sizeof(one))
+			perror("write");
+		pthread_join(aio->reaper, NULL);
+		close(aio->stop_fd);
+		ring_release(&aio->ring);
+	}
+	for (unsigned int i = 0; i < aio->nthreads; i++)
+		pthread_join(aio->threads[i], NULL);
+
+	pthread_cond_destroy(&aio->work);
+	pthread_cond_destroy(&aio->room);
+	pthread_mutex_destroy(&aio->lock);
+	free(aio);
+}
+
+const char *aio_backend(struct aio *aio)
+{
+	return aio->ring.fd >= 0 ? "io_uring" : "threads";
+}
+
+int aio_submit(struct aio *aio, int write, size_t block, size_t count,
+	       void *buf, aio_callback_t callback, void *arg)
+{
+	struct request *req;
+	size_t bcount = disk_count(aio->disk);
+
+	if (!count || block >= bcount || count > bcount - block) {
+		aio_error("block index out of bounds (%zu+%zu/%zu)",
+			  block, count, bcount);
+		return -1;
+	}
+
+	req = malloc(sizeof(*req));
+	if (!req)
+		return -1;
+
+	req->write = write;
+	req->iov.iov_base = buf;
+	req->iov.iov_len = count * BLOCK_SIZE;
+	req->offset = (off_t)block * BLOCK_SIZE;
+	req->block = block;
+	req->count = count;
+	req->callback = callback;
+	req->arg = arg;
+	req->next = NULL;
+
+	pthread_mutex_lock(&aio->lock);
+	while (aio->inflight >= aio->depth)
+		pthread_cond_wait(&aio->room, &aio->lock);
+	aio->inflight++;
+
+	if (aio->ring.fd >= 0) {
+		/* The request failed, but still counts as in flight until then */
+		if (ring_push(aio, req) == -1) {
+			pthread_mutex_unlock(&aio->lock);
+			complete(aio, req, -1);
+			return 0;
+		}
+	} else {
+		if (aio->tail)
+			aio->tail->next = req;
+		else
+			aio->head = req;
+		aio->tail = req;
+		pthread_cond_signal(&aio->work);
+	}
+	pthread_mutex_unlock(&aio->lock);
+
+	return 0;
+}
@@ -0,0 +1,82 @@
+#ifndef _AIO_H
+#define _AIO_H
+
+#include <stddef.h> /* for size_t definition */
+
+#include "disk.h"
+
+/** Use a pool of worker threads even if io_uring is available */
+#define AIO_THREADS 0x1
+
+/**
+ * typedef aio_callback_t - Completion callback of an asynchronous request
+ * @arg: Argument given when the request was submitted
+ * @ret: -1 if the transfer failed, 0 otherwise
+ */
+typedef void (*aio_callback_t)(void *arg, int ret);
+
+/*
+ * Opaque asynchronous I/O engine instance. Requests can be submitted from any
+ * thread; their callbacks run on a thread of the engine.
+ */
+struct aio;
+
+/**
+ * aio_create - Create an asynchronous I/O engine for a disk
+ * @disk: Disk instance
+ * @depth: Maximum number of requests in flight
+ * @flags: %AIO_THREADS, or 0
+ *
+ * Requests are submitted to an io_uring instance, and a thread reaps their
+ * completions. If io_uring is not available (or with %AIO_THREADS), @depth
+ * worker threads (at most 16) perform the transfers with blocking calls
+ * instead.
+ *
+ * Return: NULL if memory or threads cannot be allocated. The new engine
+ * otherwise.
+ */
+struct aio *aio_create(struct disk *disk, unsigned int depth, int flags);
+
+/**
+ * aio_destroy - Release an asynchronous I/O engine
+ * @aio: Engine
+ *
+ * Wait for the requests in flight to complete (callbacks included), then
+ * release @aio. Must not be called from a callback.
+ */
+void aio_destroy(struct aio *aio);
+
+/**
+ * aio_backend - Get the name of the backend of an engine
+ * @aio: Engine
+ *
+ * Return: "io_uring" or "threads".
+ */
+const char *aio_backend(struct aio *aio);
+
+/**
+ * aio_submit - Submit an asynchronous transfer of consecutive blocks
+ * @aio: Engine
+ * @write: Whether to write the blocks to the disk, rather than read them
+ * @block: Index of the first block
+ * @count: Number of blocks
+ * @buf: Data buffer of @count blocks, which must stay valid until completion
+ * @callback: Called once the transfer completes
+ * @arg: Argument given to @callback
+ *
+ * Block until fewer than the maximum number of requests are in flight, then
+ * queue the request and return. The request bypasses any block cache, which
+ * is up to the caller to keep coherent. Callbacks must not submit requests
+ * themselves, as they would wait for room that only their own completion can
+ * make.
+ *
+ * If the request cannot be handed over to the kernel, it completes with an
+ * error before this returns, @callback being called from the submitting thread.
+ *
+ * Return: -1 if the blocks are out of bounds or memory cannot be allocated, in
+ * which case @callback is never called. 0 otherwise.
+ */
+int aio_submit(struct aio *aio, int write, size_t block, size_t count,
+	       void *buf, aio_callback_t callback, void *arg);
+
+#endif /* _AIO_H */
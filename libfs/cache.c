@@ -0,0 +1,664 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "disk.h"
+
+#define cache_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/* Marks an empty slot link or an uncached block */
+#define NO_SLOT -1
+
+/* Maximum number of dirty blocks gathered in one write-back request */
+#define FLUSH_BATCH 64
+
+/* Maximum number of blocks prefetched with one read request */
+#define PREFETCH_BATCH 64
+
+/* Cached block description */
+struct slot {
+	/* Disk block held by this slot */
+	size_t block;
+	/* Whether the block differs from its copy on disk */
+	int dirty;
+	/* Number of cache_pin() calls not undone yet, the slot is not evicted */
+	int pins;
+	/* LRU list links */
+	int prev, next;
+	/* Block content */
+	uint8_t *data;
+};
+
+/* Block cache instance description */
+struct cache {
+	/* Protects everything below */
+	pthread_mutex_t lock;
+	/* Disk the cached blocks belong to */
+	struct disk *disk;
+	/* Maximum and current number of cached blocks */
+	size_t capacity;
+	size_t used;
+	/* Number of pinned slots */
+	size_t pinned;
+	/* Cache slots and their backing memory */
+	struct slot *slots;
+	uint8_t *pool;
+	/* Bounce block for partial accesses when there are no slots */
+	uint8_t *bounce;
+	/* Disk block index -> slot index, NO_SLOT if not cached */
+	int *map;
+	size_t bcount;
+	/* Blocks [dirty_start, dirty_end) include every dirty block */
+	size_t dirty_start, dirty_end;
+	/* Most and least recently used slots */
+	int head, tail;
+	struct cache_stats stats;
+};
+
+struct cache *cache_create(struct disk *disk, size_t capacity)
+{
+	struct cache *cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	pthread_mutex_init(&cache->lock, NULL);
+	cache->disk = disk;
+	cache->capacity = capacity;
+	cache->bcount = disk_count(disk);
+	cache->head = cache->tail = NO_SLOT;
+
+	if (!capacity) {
+		cache->bounce = aligned_alloc(BLOCK_SIZE, BLOCK_SIZE);
+		if (!cache->bounce) {
+			cache_error("cannot allocate bounce block");
+			free(cache);
+			return NULL;
+		}
+		return cache;
+	}
+
+	cache->slots = calloc(capacity, sizeof(*cache->slots));
+	cache->pool = aligned_alloc(BLOCK_SIZE, capacity * BLOCK_SIZE);
+	cache->map = malloc(cache->bcount * sizeof(*cache->map));
+	if (!cache->slots || !cache->pool || !cache->map) {
+		cache_error("cannot allocate %zu blocks", capacity);
+		cache_destroy(cache);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < cache->bcount; i++)
+		cache->map[i] = NO_SLOT;
+	for (size_t i = 0; i < capacity; i++)
+		cache->slots[i].data = cache->pool + i * BLOCK_SIZE;
+
+	return cache;
+}
+
+void cache_destroy(struct cache *cache)
+{
+	if (!cache)
+		return;
+
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->slots);
+	free(cache->pool);
+	free(cache->bounce);
+	free(cache->map);
+	free(cache);
+}
+
+/* Unlink slot @s from the LRU list */
+static void lru_remove(struct cache *cache, int s)
+{
+	struct slot *slot = &cache->slots[s];
+
+	if (slot->prev != NO_SLOT)
+		cache->slots[slot->prev].next = slot->next;
+	else
+		cache->head = slot->next;
+
+	if (slot->next != NO_SLOT)
+		cache->slots[slot->next].prev = slot->prev;
+	else
+		cache->tail = slot->prev;
+}
+
+/* Insert slot @s as the most recently used one */
+static void lru_push(struct cache *cache, int s)
+{
+	struct slot *slot = &cache->slots[s];
+
+	slot->prev = NO_SLOT;
+	slot->next = cache->head;
+	if (cache->head != NO_SLOT)
+		cache->slots[cache->head].prev = s;
+	cache->head = s;
+	if (cache->tail == NO_SLOT)
+		cache->tail = s;
+}
+
+/*
+ * Find the slot holding @block, or make room for it by taking a free slot or
+ * evicting the least recently used one. The returned slot is the most recently
+ * used one. @hit tells whether the slot already holds the block.
+ */
+static int lookup(struct cache *cache, size_t block, int *hit)
+{
+	int s = cache->map[block];
+
+	if (s != NO_SLOT) {
+		cache->stats.hits++;
+		*hit = 1;
+		lru_remove(cache, s);
+		lru_push(cache, s);
+		return s;
+	}
+
+	cache->stats.misses++;
+	*hit = 0;
+
+	if (cache->used < cache->capacity) {
+		s = cache->used++;
+	} else {
+		struct slot *victim;
+
+		/* Pinned slots are skipped, at most half of them are */
+		s = cache->tail;
+		while (cache->slots[s].pins)
+			s = cache->slots[s].prev;
+		victim = &cache->slots[s];
+		if (victim->dirty) {
+			if (disk_write_range(cache->disk, victim->block, 1,
+					     victim->data) == -1)
+				return NO_SLOT;
+			cache->stats.writebacks++;
+		}
+		/* A dropped slot no longer owns its block */
+		if (cache->map[victim->block] == s) {
+			cache->map[victim->block] = NO_SLOT;
+			cache->stats.evictions++;
+		}
+		lru_remove(cache, s);
+	}
+
+	cache->slots[s].block = block;
+	cache->slots[s].dirty = 0;
+	cache->map[block] = s;
+	lru_push(cache, s);
+
+	return s;
+}
+
+/* Mark slot @s as differing from its block on disk */
+static void set_dirty(struct cache *cache, int s)
+{
+	size_t block = cache->slots[s].block;
+
+	cache->slots[s].dirty = 1;
+	if (cache->dirty_start >= cache->dirty_end) {
+		cache->dirty_start = block;
+		cache->dirty_end = block + 1;
+	} else if (block < cache->dirty_start) {
+		cache->dirty_start = block;
+	} else if (block >= cache->dirty_end) {
+		cache->dirty_end = block + 1;
+	}
+}
+
+/* Forget about slot @s, which could not be filled, so it gets reused first */
+static void drop(struct cache *cache, int s)
+{
+	struct slot *slot = &cache->slots[s];
+
+	cache->map[slot->block] = NO_SLOT;
+	lru_remove(cache, s);
+
+	slot->prev = cache->tail;
+	slot->next = NO_SLOT;
+	if (cache->tail != NO_SLOT)
+		cache->slots[cache->tail].next = s;
+	else
+		cache->head = s;
+	cache->tail = s;
+}
+
+int cache_read(struct cache *cache, size_t block, void *buf)
+{
+	return cache_read_partial(cache, block, 0, buf, BLOCK_SIZE);
+}
+
+int cache_write(struct cache *cache, size_t block, const void *buf)
+{
+	int s, hit;
+
+	if (!cache->capacity || block >= cache->bcount)
+		return disk_write_range(cache->disk, block, 1, buf);
+
+	pthread_mutex_lock(&cache->lock);
+	if ((s = lookup(cache, block, &hit)) == NO_SLOT) {
+		pthread_mutex_unlock(&cache->lock);
+		return -1;
+	}
+
+	memcpy(cache->slots[s].data, buf, BLOCK_SIZE);
+	set_dirty(cache, s);
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
+
+/* Return the slot holding @block, reading it from disk on a miss */
+static int fill(struct cache *cache, size_t block)
+{
+	int s, hit;
+
+	if ((s = lookup(cache, block, &hit)) == NO_SLOT)
+		return NO_SLOT;
+
+	if (!hit && disk_read_range(cache->disk, block, 1,
+				    cache->slots[s].data) == -1) {
+		drop(cache, s);
+		return NO_SLOT;
+	}
+
+	return s;
+}
+
+int cache_read_partial(struct cache *cache, size_t block, size_t offset,
+		       void *buf, size_t len)
+{
+	int s;
+
+	if (!cache->capacity || block >= cache->bcount) {
+		pthread_mutex_lock(&cache->lock);
+		if (disk_read_range(cache->disk, block, 1,
+				    cache->bounce) == -1) {
+			pthread_mutex_unlock(&cache->lock);
+			return -1;
+		}
+		memcpy(buf, cache->bounce + offset, len);
+		pthread_mutex_unlock(&cache->lock);
+		return 0;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	if ((s = fill(cache, block)) == NO_SLOT) {
+		pthread_mutex_unlock(&cache->lock);
+		return -1;
+	}
+
+	memcpy(buf, cache->slots[s].data + offset, len);
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
+
+int cache_write_partial(struct cache *cache, size_t block, size_t offset,
+			const void *buf, size_t len)
+{
+	int s, ret;
+
+	pthread_mutex_lock(&cache->lock);
+
+	if (!cache->capacity || block >= cache->bcount) {
+		ret = disk_read_range(cache->disk, block, 1, cache->bounce);
+		if (!ret) {
+			memcpy(cache->bounce + offset, buf, len);
+			ret = disk_write_range(cache->disk, block, 1,
+					       cache->bounce);
+		}
+		pthread_mutex_unlock(&cache->lock);
+		return ret;
+	}
+
+	if ((s = fill(cache, block)) == NO_SLOT) {
+		pthread_mutex_unlock(&cache->lock);
+		return -1;
+	}
+
+	memcpy(cache->slots[s].data + offset, buf, len);
+	set_dirty(cache, s);
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
+
+int cache_write_new(struct cache *cache, size_t block, const void *buf,
+		    size_t len)
+{
+	uint8_t *data;
+	int s, hit, ret = 0;
+
+	pthread_mutex_lock(&cache->lock);
+
+	if (!cache->capacity || block >= cache->bcount) {
+		data = cache->bounce;
+	} else {
+		if ((s = lookup(cache, block, &hit)) == NO_SLOT) {
+			pthread_mutex_unlock(&cache->lock);
+			return -1;
+		}
+		data = cache->slots[s].data;
+		set_dirty(cache, s);
+	}
+
+	memcpy(data, buf, len);
+	memset(data + len, 0, BLOCK_SIZE - len);
+
+	if (data == cache->bounce)
+		ret = disk_write_range(cache->disk, block, 1, data);
+	pthread_mutex_unlock(&cache->lock);
+	return ret;
+}
+
+int cache_read_range(struct cache *cache, size_t block, size_t count,
+		     void *buf)
+{
+	uint8_t *dst = buf;
+	size_t i = 0;
+
+	if (!cache->capacity || block >= cache->bcount
+	    || count > cache->bcount - block)
+		return disk_read_range(cache->disk, block, count, buf);
+
+	pthread_mutex_lock(&cache->lock);
+	while (i < count) {
+		size_t run;
+		int s = cache->map[block + i];
+
+		if (s != NO_SLOT) {
+			cache->stats.hits++;
+			lru_remove(cache, s);
+			lru_push(cache, s);
+			memcpy(dst + i * BLOCK_SIZE, cache->slots[s].data,
+			       BLOCK_SIZE);
+			i++;
+			continue;
+		}
+
+		/* Read the whole run of uncached blocks at once */
+		for (run = 1; i + run < count; run++)
+			if (cache->map[block + i + run] != NO_SLOT)
+				break;
+
+		/*
+		 * The caller owns the blocks, so nobody else can get them
+		 * cached meanwhile: let other threads use the cache during the
+		 * read.
+		 */
+		cache->stats.misses += run;
+		pthread_mutex_unlock(&cache->lock);
+		if (disk_read_range(cache->disk, block + i, run,
+				    dst + i * BLOCK_SIZE))
+			return -1;
+		pthread_mutex_lock(&cache->lock);
+		i += run;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return 0;
+}
+
+int cache_peek(struct cache *cache, size_t block, void *buf)
+{
+	int s;
+
+	if (!cache->capacity || block >= cache->bcount)
+		return -1;
+
+	pthread_mutex_lock(&cache->lock);
+	s = cache->map[block];
+	if (s == NO_SLOT) {
+		cache->stats.misses++;
+		pthread_mutex_unlock(&cache->lock);
+		return -1;
+	}
+
+	cache->stats.hits++;
+	lru_remove(cache, s);
+	lru_push(cache, s);
+	memcpy(buf, cache->slots[s].data, BLOCK_SIZE);
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
+
+void cache_update(struct cache *cache, size_t block, size_t count,
+		  const void *buf, int dirty)
+{
+	const uint8_t *src = buf;
+
+	if (!cache->capacity || block >= cache->bcount
+	    || count > cache->bcount - block)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+	for (size_t i = 0; i < count; i++) {
+		int s = cache->map[block + i];
+
+		if (s == NO_SLOT)
+			continue;
+		memcpy(cache->slots[s].data, src + i * BLOCK_SIZE, BLOCK_SIZE);
+		if (dirty)
+			set_dirty(cache, s);
+		else
+			cache->slots[s].dirty = 0;
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+int cache_write_range(struct cache *cache, size_t block, size_t count,
+		      const void *buf)
+{
+	/*
+	 * Update the cached copies first, as clean blocks, so that an eviction
+	 * during the write cannot write back stale content over it.
+	 */
+	cache_update(cache, block, count, buf, 0);
+
+	if (disk_write_range(cache->disk, block, count, buf) == 0)
+		return 0;
+
+	/* The cached copies are now the only up-to-date ones */
+	cache_update(cache, block, count, buf, 1);
+
+	return -1;
+}
+
+int cache_prefetch(struct cache *cache, size_t block, size_t count)
+{
+	struct iovec iov[PREFETCH_BATCH];
+	int slots[PREFETCH_BATCH];
+	size_t i = 0;
+	int ret = 0;
+
+	if (!cache->capacity || block >= cache->bcount
+	    || count > cache->bcount - block)
+		return 0;
+
+	/*
+	 * The new slots are visible as soon as they are taken, so the lock is
+	 * held until they are filled.
+	 */
+	pthread_mutex_lock(&cache->lock);
+	while (i < count) {
+		int cnt = 0;
+
+		if (cache->map[block + i] != NO_SLOT) {
+			i++;
+			continue;
+		}
+
+		/* Read each run of uncached blocks with a single request */
+		while (i + cnt < count && cnt < PREFETCH_BATCH
+		       && cache->map[block + i + cnt] == NO_SLOT) {
+			int hit, s = lookup(cache, block + i + cnt, &hit);
+
+			if (s == NO_SLOT)
+				break;
+			slots[cnt] = s;
+			iov[cnt].iov_base = cache->slots[s].data;
+			iov[cnt].iov_len = BLOCK_SIZE;
+			cnt++;
+		}
+
+		if (!cnt || disk_readv(cache->disk, block + i, iov, cnt)) {
+			for (int j = 0; j < cnt; j++)
+				drop(cache, slots[j]);
+			ret = -1;
+			break;
+		}
+		i += cnt;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return ret;
+}
+
+void *cache_pin(struct cache *cache, size_t block)
+{
+	int s;
+
+	if (!cache->capacity || block >= cache->bcount)
+		return NULL;
+
+	pthread_mutex_lock(&cache->lock);
+	if ((s = fill(cache, block)) == NO_SLOT) {
+		pthread_mutex_unlock(&cache->lock);
+		return NULL;
+	}
+
+	/* Keep room for the blocks that are not pinned */
+	if (!cache->slots[s].pins && cache->pinned >= cache->capacity / 2) {
+		pthread_mutex_unlock(&cache->lock);
+		return NULL;
+	}
+
+	if (!cache->slots[s].pins++)
+		cache->pinned++;
+	pthread_mutex_unlock(&cache->lock);
+	return cache->slots[s].data;
+}
+
+void cache_unpin(struct cache *cache, const void *data, size_t len)
+{
+	size_t first = ((const uint8_t *)data - cache->pool) / BLOCK_SIZE;
+	size_t last = ((const uint8_t *)data + len - 1 - cache->pool) / BLOCK_SIZE;
+
+	pthread_mutex_lock(&cache->lock);
+	for (size_t s = first; s <= last; s++)
+		if (!--cache->slots[s].pins)
+			cache->pinned--;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* Write back the dirty blocks among blocks [@start, @end), with the lock held */
+static int writeback(struct cache *cache, size_t start, size_t end)
+{
+	struct iovec iov[FLUSH_BATCH];
+	size_t from, to, first = 0;
+	int cnt = 0;
+
+	/* Only the part of the range which can hold dirty blocks is walked */
+	from = start > cache->dirty_start ? start : cache->dirty_start;
+	to = end < cache->dirty_end ? end : cache->dirty_end;
+	if (from >= to)
+		return 0;
+
+	/*
+	 * Walk the map rather than the LRU list to write in disk order, and
+	 * gather consecutive dirty blocks into a single request.
+	 */
+	for (size_t i = from; i <= to; i++) {
+		int s = i < to ? cache->map[i] : NO_SLOT;
+		int dirty = s != NO_SLOT && cache->slots[s].dirty;
+
+		if (cnt && (!dirty || cnt == FLUSH_BATCH)) {
+			if (disk_writev(cache->disk, first, iov, cnt))
+				return -1;
+			for (int j = 0; j < cnt; j++)
+				cache->slots[cache->map[first + j]].dirty = 0;
+			cache->stats.writebacks += cnt;
+			cnt = 0;
+		}
+
+		if (!dirty)
+			continue;
+
+		if (!cnt)
+			first = i;
+		iov[cnt].iov_base = cache->slots[s].data;
+		iov[cnt].iov_len = BLOCK_SIZE;
+		cnt++;
+	}
+
+	/* The range is clean now, shrink the dirty one if it covers an end */
+	if (from == cache->dirty_start)
+		cache->dirty_start = to;
+	if (to == cache->dirty_end)
+		cache->dirty_end = from;
+	return 0;
+}
+
+int cache_flush(struct cache *cache)
+{
+	int ret;
+
+	pthread_mutex_lock(&cache->lock);
+	ret = writeback(cache, 0, cache->bcount);
+	pthread_mutex_unlock(&cache->lock);
+
+	return ret;
+}
+
+int cache_flush_range(struct cache *cache, size_t block, size_t count)
+{
+	int ret;
+
+	if (!cache->capacity || block >= cache->bcount
+	    || count > cache->bcount - block)
+		return 0;
+
+	pthread_mutex_lock(&cache->lock);
+	ret = writeback(cache, block, block + count);
+	pthread_mutex_unlock(&cache->lock);
+
+	return ret;
+}
+
+int cache_reload(struct cache *cache, size_t block, size_t count)
+{
+	int ret = 0;
+
+	if (!cache->capacity || block >= cache->bcount
+	    || count > cache->bcount - block)
+		return 0;
+
+	pthread_mutex_lock(&cache->lock);
+	for (size_t i = block; i < block + count; i++) {
+		int s = cache->map[i];
+
+		if (s == NO_SLOT)
+			continue;
+		if (disk_read_range(cache->disk, i, 1, cache->slots[s].data)) {
+			ret = -1;
+			/* Pinned copies stay, stale rather than dangling */
+			if (!cache->slots[s].pins)
+				drop(cache, s);
+			continue;
+		}
+		cache->slots[s].dirty = 0;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return ret;
+}
+
+void cache_get_stats(struct cache *cache, struct cache_stats *stats)
+{
+	pthread_mutex_lock(&cache->lock);
+	*stats = cache->stats;
+	pthread_mutex_unlock(&cache->lock);
+}
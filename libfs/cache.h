@@ -0,0 +1,271 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h> /* for size_t definition */
+
+#include "disk.h"
+
+/** Block cache statistics */
+struct cache_stats {
+	/* Lookups served from memory */
+	size_t hits;
+	/* Lookups that had to go to the disk */
+	size_t misses;
+	/* Blocks dropped from the cache to make room for another one */
+	size_t evictions;
+	/* Dirty blocks written back to the disk */
+	size_t writebacks;
+};
+
+/*
+ * Opaque block cache instance. Every operation is thread-safe, but concurrent
+ * accesses to the same block must be serialized by the caller.
+ */
+struct cache;
+
+/**
+ * cache_create - Create a block cache for a disk
+ * @disk: Disk instance
+ * @capacity: Maximum number of blocks held in memory
+ *
+ * Create a write-back block cache with LRU eviction sitting on top of virtual
+ * disk @disk. A @capacity of 0 creates a pass-through cache which forwards
+ * every request to the disk.
+ *
+ * Return: NULL if memory cannot be allocated. The new cache otherwise.
+ */
+struct cache *cache_create(struct disk *disk, size_t capacity);
+
+/**
+ * cache_destroy - Release a block cache
+ * @cache: Block cache
+ *
+ * Release all the memory held by @cache. Dirty blocks are discarded, so
+ * cache_flush() must be called first if their content matters.
+ */
+void cache_destroy(struct cache *cache);
+
+/**
+ * cache_read - Read a block through the cache
+ * @cache: Block cache
+ * @block: Index of the block to read from
+ * @buf: Data buffer to be filled with content of block
+ *
+ * Return: -1 if the block cannot be read from the disk. 0 otherwise.
+ */
+int cache_read(struct cache *cache, size_t block, void *buf);
+
+/**
+ * cache_write - Write a block through the cache
+ * @cache: Block cache
+ * @block: Index of the block to write to
+ * @buf: Data buffer to write in the block
+ *
+ * The block is only marked dirty and reaches the disk when it gets evicted or
+ * when the cache is flushed.
+ *
+ * Return: -1 if @block is out of bounds, or if writing back an evicted block
+ * fails. 0 otherwise.
+ */
+int cache_write(struct cache *cache, size_t block, const void *buf);
+
+/**
+ * cache_read_partial - Read part of a block through the cache
+ * @cache: Block cache
+ * @block: Index of the block to read from
+ * @offset: Offset of the first byte to read within the block
+ * @buf: Data buffer to be filled with @len bytes
+ * @len: Number of bytes to read
+ *
+ * The bytes are copied straight from the cached block, which is read from the
+ * disk on a miss. A pass-through cache reads the block into its own bounce
+ * block.
+ *
+ * Return: -1 if the block cannot be read from the disk. 0 otherwise.
+ */
+int cache_read_partial(struct cache *cache, size_t block, size_t offset,
+		       void *buf, size_t len);
+
+/**
+ * cache_write_partial - Write part of a block through the cache
+ * @cache: Block cache
+ * @block: Index of the block to write to
+ * @offset: Offset of the first byte to write within the block
+ * @buf: Data buffer holding @len bytes to write
+ * @len: Number of bytes to write
+ *
+ * The bytes are copied straight into the cached block, which is read from the
+ * disk on a miss, and the block is marked dirty. A pass-through cache does the
+ * read-modify-write in its own bounce block.
+ *
+ * Return: -1 if the block cannot be read from or written to the disk. 0
+ * otherwise.
+ */
+int cache_write_partial(struct cache *cache, size_t block, size_t offset,
+			const void *buf, size_t len);
+
+/**
+ * cache_write_new - Write the beginning of a block through the cache
+ * @cache: Block cache
+ * @block: Index of the block to write to
+ * @buf: Data buffer holding @len bytes to write
+ * @len: Number of bytes to write
+ *
+ * Same as cache_write_partial() at offset 0, for a block whose current content
+ * does not matter (e.g., a block that was just allocated): the block is not read
+ * from the disk, and the rest of it is filled with zeros.
+ *
+ * Return: -1 if @block is out of bounds, or if writing back an evicted block
+ * fails. 0 otherwise.
+ */
+int cache_write_new(struct cache *cache, size_t block, const void *buf,
+		    size_t len);
+
+/**
+ * cache_read_range - Read consecutive blocks through the cache
+ * @cache: Block cache
+ * @block: Index of the first block to read from
+ * @count: Number of blocks to read
+ * @buf: Data buffer to be filled with content of blocks
+ *
+ * Cached blocks are copied from memory, and each run of uncached blocks is read
+ * from the disk with a single request. Blocks read from the disk are not added
+ * to the cache, so that large transfers do not flush it. Other threads can use
+ * the cache while the disk is read.
+ *
+ * Return: -1 if the blocks cannot be read from the disk. 0 otherwise.
+ */
+int cache_read_range(struct cache *cache, size_t block, size_t count,
+		     void *buf);
+
+/**
+ * cache_write_range - Write consecutive blocks through the cache
+ * @cache: Block cache
+ * @block: Index of the first block to write to
+ * @count: Number of blocks to write
+ * @buf: Data buffer to write in the blocks
+ *
+ * The blocks are written to the disk with a single request, and the cached
+ * copies of any of them are updated and become clean.
+ *
+ * Return: -1 if the blocks cannot be written to the disk. 0 otherwise.
+ */
+int cache_write_range(struct cache *cache, size_t block, size_t count,
+		      const void *buf);
+
+/**
+ * cache_peek - Read a block if it is cached
+ * @cache: Block cache
+ * @block: Index of the block to read from
+ * @buf: Data buffer to be filled with content of block
+ *
+ * Return: -1 if @block is not cached, in which case the disk is not accessed.
+ * 0 if it was copied from memory.
+ */
+int cache_peek(struct cache *cache, size_t block, void *buf);
+
+/**
+ * cache_update - Update the cached copies of consecutive blocks
+ * @cache: Block cache
+ * @block: Index of the first block
+ * @count: Number of blocks
+ * @buf: New content of the blocks
+ * @dirty: Whether the updated copies differ from the disk
+ *
+ * Blocks that are not cached are left alone, so this is meant for callers
+ * writing the blocks to the disk on their own: before the write, the copies
+ * are updated as clean, and marked dirty again if the write fails.
+ */
+void cache_update(struct cache *cache, size_t block, size_t count,
+		  const void *buf, int dirty);
+
+/**
+ * cache_prefetch - Load consecutive blocks into the cache
+ * @cache: Block cache
+ * @block: Index of the first block to load
+ * @count: Number of blocks to load
+ *
+ * Blocks that are not cached yet are read from the disk, each run of them with
+ * a single request, and become the most recently used ones, so that upcoming
+ * reads find them in memory. @count should stay well below the capacity of
+ * the cache. A pass-through cache does nothing.
+ *
+ * Return: -1 if the blocks cannot be read from the disk, or if writing back an
+ * evicted block fails. 0 otherwise.
+ */
+int cache_prefetch(struct cache *cache, size_t block, size_t count);
+
+/**
+ * cache_pin - Keep a block in the cache and get its cached copy
+ * @cache: Block cache
+ * @block: Index of the block
+ *
+ * The block is read from the disk on a miss, and is not evicted until every
+ * cache_pin() of it is undone by cache_unpin(). Writes through the cache still
+ * update the pinned copy in place. At most half of the cache can be pinned.
+ *
+ * Return: NULL if @cache is a pass-through cache, if the block cannot be read
+ * from the disk, or if too many blocks are pinned. The address of the cached
+ * copy of the block (%BLOCK_SIZE bytes) otherwise.
+ */
+void *cache_pin(struct cache *cache, size_t block);
+
+/**
+ * cache_unpin - Release pinned blocks
+ * @cache: Block cache
+ * @data: Address within the cached copy of a pinned block
+ * @len: Number of bytes from @data
+ *
+ * Undo one cache_pin() of every block whose cached copy holds some of the @len
+ * bytes at @data. Cached copies of consecutive blocks may be adjacent in
+ * memory, so a range can span several of them.
+ */
+void cache_unpin(struct cache *cache, const void *data, size_t len);
+
+/**
+ * cache_flush - Write back all dirty blocks
+ * @cache: Block cache
+ *
+ * Dirty blocks are written in increasing block order and stay cached. Runs of
+ * consecutive dirty blocks are gathered into a single write request.
+ *
+ * Return: -1 if a block cannot be written back. 0 otherwise.
+ */
+int cache_flush(struct cache *cache);
+
+/**
+ * cache_flush_range - Write back the dirty blocks among consecutive blocks
+ * @cache: Block cache
+ * @block: Index of the first block
+ * @count: Number of blocks
+ *
+ * Same as cache_flush(), restricted to blocks @block to @block + @count - 1, so
+ * that their content on disk can be accessed directly.
+ *
+ * Return: -1 if a block cannot be written back. 0 otherwise.
+ */
+int cache_flush_range(struct cache *cache, size_t block, size_t count);
+
+/**
+ * cache_reload - Refresh the cached copies of consecutive blocks
+ * @cache: Block cache
+ * @block: Index of the first block
+ * @count: Number of blocks
+ *
+ * Read the cached copies among blocks @block to @block + @count - 1 again from
+ * the disk, after they were written to it directly. Their dirty content, if
+ * any, is lost, so the caller must have flushed it first (or overwritten the
+ * whole blocks).
+ *
+ * Return: -1 if a block cannot be read from the disk. 0 otherwise.
+ */
+int cache_reload(struct cache *cache, size_t block, size_t count);
+
+/**
+ * cache_get_stats - Get cache statistics
+ * @cache: Block cache
+ * @stats: Statistics to be filled
+ */
+void cache_get_stats(struct cache *cache, struct cache_stats *stats);
+
+#endif /* _CACHE_H */
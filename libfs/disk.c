@@ -1,17 +1,68 @@
+#define _GNU_SOURCE /* for copy_file_range() and splice() */
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "disk.h"
+#include "stats.h"
 
 #define block_error(fmt, ...) \
 	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
 
-/* Invalid file descriptor */
-#define INVALID_FD -1
+/* Maximum number of buffers per vectored request (POSIX minimum IOV_MAX) */
+#define DISK_IOV_MAX 1024
+
+/* Number of blocks needed to hold @n bytes */
+#define BLOCKS(n) (((n) + BLOCK_SIZE - 1) / BLOCK_SIZE)
+
+/* Size of the bounce buffer of copies the kernel cannot do on its own */
+#define COPY_BOUNCE_SIZE (16 * BLOCK_SIZE)
+
+/* Ways of copying between the disk and another descriptor, by preference */
+enum copy_method {
+	COPY_FILE_RANGE,
+	COPY_SENDFILE,
+	COPY_SPLICE,
+	COPY_BOUNCE,
+};
+
+/*
+ * Durability requests. Each request takes a ticket, and is covered by the
+ * first sync started after it. Only one sync runs at a time: requests issued
+ * meanwhile are all covered by the next one.
+ */
+struct syncer {
+	pthread_mutex_t lock;
+	/* Signaled when a sync completes */
+	pthread_cond_t done;
+	/* Last ticket issued, and last ticket covered by a completed sync */
+	unsigned long requested;
+	unsigned long completed;
+	/* Last ticket covered by a failed sync */
+	unsigned long failed;
+	/* Whether a sync is running */
+	int running;
+	/* Background thread serving deferred requests */
+	pthread_t flusher;
+	pthread_cond_t wake;
+	int flusher_started;
+	int stopping;
+	/* Whether deferred requests are pending, and when they are due */
+	int deferred;
+	struct timespec deadline;
+	/* Whether a deferred sync failed since it was last reported */
+	int deferred_error;
+};
 
 /* Disk instance description */
 struct disk {
@@ -19,126 +70,755 @@ struct disk {
 	int fd;
 	/* Block count */
 	size_t bcount;
+	/* Mapping of the whole disk image, NULL for file descriptor I/O */
+	char *map;
+	struct syncer syncer;
+	/* Updated with stats_add() */
+	struct disk_stats stats;
 };
 
-/* Currently open virtual disk (invalid by default) */
-static struct disk disk = { .fd = INVALID_FD };
+/* Disk used by the block_* functions (none by default) */
+static struct disk *current;
 
-int block_disk_open(const char *diskname)
+struct disk *disk_open(const char *diskname, int use_mmap)
 {
+	struct disk *disk;
 	int fd;
 	struct stat st;
+	char *map = NULL;
 
 	if (!diskname) {
 		block_error("invalid file diskname");
-		return -1;
-	}
-
-	if (disk.fd != INVALID_FD) {
-		block_error("disk already open");
-		return -1;
+		return NULL;
 	}
 
 	if ((fd = open(diskname, O_RDWR, 0644)) < 0) {
 		perror("open");
-		return -1;
+		return NULL;
 	}
 
 	if (fstat(fd, &st)) {
 		perror("fstat");
-		return -1;
+		close(fd);
+		return NULL;
 	}
 
 	/* The disk image's size should be a multiple of the block size */
 	if (st.st_size % BLOCK_SIZE != 0) {
 		block_error("size '%zu' is not multiple of '%d'",
 			    st.st_size, BLOCK_SIZE);
+		close(fd);
+		return NULL;
+	}
+
+	if (use_mmap) {
+		map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   fd, 0);
+		if (map == MAP_FAILED) {
+			perror("mmap");
+			close(fd);
+			return NULL;
+		}
+	}
+
+	disk = calloc(1, sizeof(*disk));
+	if (!disk) {
+		perror("calloc");
+		if (map)
+			munmap(map, st.st_size);
+		close(fd);
+		return NULL;
+	}
+
+	disk->fd = fd;
+	disk->bcount = st.st_size / BLOCK_SIZE;
+	disk->map = map;
+	pthread_mutex_init(&disk->syncer.lock, NULL);
+	pthread_cond_init(&disk->syncer.done, NULL);
+	pthread_cond_init(&disk->syncer.wake, NULL);
+
+	return disk;
+}
+
+struct disk *disk_create(const char *diskname, size_t bcount, int sparse)
+{
+	off_t size = (off_t)bcount * BLOCK_SIZE;
+	int fd, err;
+
+	if (!diskname || !bcount) {
+		block_error("invalid file diskname or block count");
+		return NULL;
+	}
+
+	if ((fd = open(diskname, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		perror("open");
+		return NULL;
+	}
+
+	/*
+	 * The file was just truncated, so extending it reads as zeros either
+	 * way: as holes, or as extents the host file system allocates without
+	 * writing them.
+	 */
+	if (ftruncate(fd, size)) {
+		perror("ftruncate");
+		close(fd);
+		return NULL;
+	}
+	if (!sparse && (err = posix_fallocate(fd, 0, size))) {
+		errno = err;
+		perror("posix_fallocate");
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	return disk_open(diskname, 0);
+}
+
+static void stop_flusher(struct disk *disk);
+
+int disk_close(struct disk *disk)
+{
+	struct syncer *syncer = &disk->syncer;
+	int ret = 0;
+
+	/* Serve the pending deferred requests */
+	stop_flusher(disk);
+	if (syncer->deferred_error) {
+		block_error("deferred sync failed");
+		ret = -1;
+	}
+
+	if (disk->map) {
+		/* Make sure everything written through the mapping hits the file */
+		if (msync(disk->map, disk->bcount * BLOCK_SIZE, MS_SYNC)) {
+			perror("msync");
+			ret = -1;
+		}
+		munmap(disk->map, disk->bcount * BLOCK_SIZE);
+	}
+
+	close(disk->fd);
+
+	pthread_mutex_destroy(&syncer->lock);
+	pthread_cond_destroy(&syncer->done);
+	pthread_cond_destroy(&syncer->wake);
+	free(disk);
+
+	return ret;
+}
+
+size_t disk_count(struct disk *disk)
+{
+	return disk->bcount;
+}
+
+int block_disk_open(const char *diskname)
+{
+	if (current) {
+		block_error("disk already open");
 		return -1;
 	}
 
-	disk.fd = fd;
-	disk.bcount = st.st_size / BLOCK_SIZE;
+	current = disk_open(diskname, 0);
+	return current ? 0 : -1;
+}
 
-	return 0;
+int block_disk_open_mmap(const char *diskname)
+{
+	if (current) {
+		block_error("disk already open");
+		return -1;
+	}
+
+	current = disk_open(diskname, 1);
+	return current ? 0 : -1;
 }
 
 int block_disk_close(void)
 {
-	if (disk.fd == INVALID_FD) {
+	struct disk *disk = current;
+
+	if (!disk) {
 		block_error("no disk currently open");
 		return -1;
 	}
 
-	close(disk.fd);
-
-	disk.fd = INVALID_FD;
-
-	return 0;
+	current = NULL;
+	return disk_close(disk);
 }
 
 int block_disk_count(void)
 {
-	if (disk.fd == INVALID_FD) {
+	if (!current) {
 		block_error("no disk currently open");
 		return -1;
 	}
 
-	return disk.bcount;
+	return current->bcount;
 }
 
-int block_write(size_t block, const void *buf)
+/* Check that blocks [@block, @block + @count) are within the bounds of @disk */
+static int check_range(struct disk *disk, size_t block, size_t count)
 {
-	if (disk.fd == INVALID_FD) {
-		block_error("no disk currently open");
+	if (block >= disk->bcount || count > disk->bcount - block) {
+		block_error("block index out of bounds (%zu+%zu/%zu)",
+			    block, count, disk->bcount);
 		return -1;
 	}
 
-	if (block >= disk.bcount) {
-		block_error("block index out of bounds (%zu/%zu)",
-			    block, disk.bcount);
+	return 0;
+}
+
+/*
+ * Transfer the blocks described by @iov between the disk and memory, starting
+ * at block @block. Partial transfers are resumed until all the bytes have been
+ * moved. @iov is consumed in the process.
+ */
+static int disk_iov(struct disk *disk, size_t block, struct iovec *iov,
+		    int iovcnt, int write)
+{
+	off_t offset = (off_t)block * BLOCK_SIZE;
+
+#ifdef FS_STATS
+	size_t len = 0;
+
+	for (int i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (write) {
+		stats_add(disk->stats.writes, 1);
+		stats_add(disk->stats.bytes_written, len);
+	} else {
+		stats_add(disk->stats.reads, 1);
+		stats_add(disk->stats.bytes_read, len);
+	}
+#endif
+
+	if (disk->map) {
+		for (int i = 0; i < iovcnt; i++) {
+			if (write)
+				memcpy(disk->map + offset, iov[i].iov_base,
+				       iov[i].iov_len);
+			else
+				memcpy(iov[i].iov_base, disk->map + offset,
+				       iov[i].iov_len);
+			offset += iov[i].iov_len;
+		}
+		return 0;
+	}
+
+	while (iovcnt > 0) {
+		int cnt = iovcnt < DISK_IOV_MAX ? iovcnt : DISK_IOV_MAX;
+		ssize_t ret;
+
+		if (write)
+			ret = pwritev(disk->fd, iov, cnt, offset);
+		else
+			ret = preadv(disk->fd, iov, cnt, offset);
+
+		if (ret < 0) {
+			perror(write ? "pwritev" : "preadv");
+			return -1;
+		}
+		if (ret == 0) {
+			block_error("unexpected end of disk at offset %lld",
+				    (long long)offset);
+			return -1;
+		}
+
+		offset += ret;
+		/* Skip what was entirely transferred, trim the rest */
+		while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+/* Count the blocks described by @iov, or return -1 if it is malformed */
+static long iov_blocks(const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+
+	if (!iov || iovcnt <= 0)
 		return -1;
+
+	for (int i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len % BLOCK_SIZE) {
+			block_error("iovec length '%zu' is not multiple of '%d'",
+				    iov[i].iov_len, BLOCK_SIZE);
+			return -1;
+		}
+		len += iov[i].iov_len;
 	}
 
-	/* Move to the specified block number */
-	if (lseek(disk.fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
-		perror("lseek");
+	return len / BLOCK_SIZE;
+}
+
+/* Transfer a vector supplied by the caller, without modifying it */
+static int disk_iov_copy(struct disk *disk, size_t block,
+			 const struct iovec *iov, int iovcnt, int write)
+{
+	struct iovec *copy;
+	long count;
+	int ret;
+
+	if ((count = iov_blocks(iov, iovcnt)) < 0)
+		return -1;
+
+	if (check_range(disk, block, count))
+		return -1;
+
+	copy = malloc(iovcnt * sizeof(*copy));
+	if (!copy) {
+		perror("malloc");
 		return -1;
 	}
+	memcpy(copy, iov, iovcnt * sizeof(*copy));
+
+	ret = disk_iov(disk, block, copy, iovcnt, write);
+	free(copy);
+
+	return ret;
+}
+
+int disk_write_range(struct disk *disk, size_t block, size_t count,
+		     const void *buf)
+{
+	struct iovec iov = { .iov_base = (void *)buf,
+			     .iov_len = count * BLOCK_SIZE };
+
+	if (check_range(disk, block, count))
+		return -1;
 
 	/* Perform the actual write into the disk image */
-	if (write(disk.fd, buf, BLOCK_SIZE) < 0) {
-		perror("write");
+	return disk_iov(disk, block, &iov, 1, 1);
+}
+
+int disk_read_range(struct disk *disk, size_t block, size_t count, void *buf)
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = count * BLOCK_SIZE };
+
+	if (check_range(disk, block, count))
 		return -1;
+
+	/* Perform the actual read from the disk image */
+	return disk_iov(disk, block, &iov, 1, 0);
+}
+
+int disk_writev(struct disk *disk, size_t block, const struct iovec *iov,
+		int iovcnt)
+{
+	return disk_iov_copy(disk, block, iov, iovcnt, 1);
+}
+
+int disk_readv(struct disk *disk, size_t block, const struct iovec *iov,
+	       int iovcnt)
+{
+	return disk_iov_copy(disk, block, iov, iovcnt, 0);
+}
+
+void *disk_map(struct disk *disk, size_t block)
+{
+	if (!disk->map || block >= disk->bcount)
+		return NULL;
+
+	return disk->map + block * BLOCK_SIZE;
+}
+
+int disk_fd(struct disk *disk)
+{
+	return disk->fd;
+}
+
+/* Whether @err means that a copy method does not apply to the descriptors */
+static int copy_unsupported(int err)
+{
+	return err == EINVAL || err == EXDEV || err == EBADF || err == ENOSYS
+		|| err == EOPNOTSUPP || err == ESPIPE;
+}
+
+/* Write the @len bytes of @buf to @fd, at its current file position */
+static int write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t ret = write(fd, buf, len);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("write");
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
 	}
 
 	return 0;
 }
 
-int block_read(size_t block, void *buf)
+/*
+ * Move up to @len bytes between the disk at byte @pos and @fd, with @method.
+ * Return the number of bytes moved, 0 at the end of @fd, or -1 with errno set.
+ */
+static ssize_t copy_chunk(struct disk *disk, off_t pos, int fd, size_t len,
+			  int out, enum copy_method method, char *bounce)
 {
-	if (disk.fd == INVALID_FD) {
-		block_error("no disk currently open");
+	ssize_t ret;
+
+	switch (method) {
+	case COPY_FILE_RANGE:
+		if (out)
+			return copy_file_range(disk->fd, &pos, fd, NULL, len,
+					       0);
+		return copy_file_range(fd, NULL, disk->fd, &pos, len, 0);
+	case COPY_SENDFILE:
+		/* Only the source can be positioned explicitly */
+		if (out)
+			return sendfile(fd, disk->fd, &pos, len);
+		errno = EINVAL;
 		return -1;
+	case COPY_SPLICE:
+		/* One of the two descriptors must be a pipe */
+		if (out)
+			return splice(disk->fd, &pos, fd, NULL, len, 0);
+		return splice(fd, NULL, disk->fd, &pos, len, 0);
+	default:
+		if (len > COPY_BOUNCE_SIZE)
+			len = COPY_BOUNCE_SIZE;
+		stats_add(disk->stats.bounce_copies, 1);
+		stats_add(disk->stats.bounce_bytes, len);
+		if (out) {
+			ret = pread(disk->fd, bounce, len, pos);
+			if (ret > 0 && write_all(fd, bounce, ret))
+				return -1;
+			return ret;
+		}
+		ret = read(fd, bounce, len);
+		if (ret > 0 && pwrite(disk->fd, bounce, ret, pos) != ret)
+			return -1;
+		return ret;
 	}
+}
 
-	if (block >= disk.bcount) {
-		block_error("block index out of bounds (%zu/%zu)",
-			    block, disk.bcount);
-		return -1;
+/* Copy @len bytes between the disk at byte @pos and @fd, in direction @out */
+static ssize_t disk_copy(struct disk *disk, off_t pos, int fd, size_t len,
+			 int out)
+{
+	enum copy_method method = COPY_FILE_RANGE;
+	char *bounce = NULL;
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t ret;
+
+		if (method == COPY_BOUNCE && !bounce) {
+			bounce = malloc(COPY_BOUNCE_SIZE);
+			if (!bounce) {
+				perror("malloc");
+				return -1;
+			}
+		}
+
+		ret = copy_chunk(disk, pos + done, fd, len - done, out, method,
+				 bounce);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			/* The failed call moved nothing, try the next method */
+			if (method != COPY_BOUNCE && copy_unsupported(errno)) {
+				method++;
+				continue;
+			}
+			perror(out ? "copy to fd" : "copy from fd");
+			free(bounce);
+			return -1;
+		}
+		if (ret == 0)
+			break;
+		done += ret;
 	}
 
-	/* Move to the specified block number */
-	if (lseek(disk.fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
-		perror("lseek");
+	free(bounce);
+	return done;
+}
+
+int disk_copy_out(struct disk *disk, size_t block, size_t offset, int fd,
+		  size_t len)
+{
+	ssize_t ret;
+
+	if (check_range(disk, block, BLOCKS(offset + len)))
+		return -1;
+
+	ret = disk_copy(disk, (off_t)block * BLOCK_SIZE + offset, fd, len, 1);
+	stats_add(disk->stats.reads, 1);
+	stats_add(disk->stats.bytes_read, ret > 0 ? ret : 0);
+	if (ret >= 0 && (size_t)ret < len) {
+		block_error("unexpected end of disk");
 		return -1;
 	}
 
-	/* Perform the actual read from the disk image */
-	if (read(disk.fd, buf, BLOCK_SIZE) < 0) {
-		perror("read");
+	return ret < 0 ? -1 : 0;
+}
+
+ssize_t disk_copy_in(struct disk *disk, size_t block, size_t offset, int fd,
+		     size_t len)
+{
+	ssize_t ret;
+
+	if (check_range(disk, block, BLOCKS(offset + len)))
 		return -1;
+
+	ret = disk_copy(disk, (off_t)block * BLOCK_SIZE + offset, fd, len, 0);
+	stats_add(disk->stats.writes, 1);
+	stats_add(disk->stats.bytes_written, ret > 0 ? ret : 0);
+
+	return ret;
+}
+
+void disk_get_stats(struct disk *disk, struct disk_stats *stats)
+{
+	stats->reads = stats_read(disk->stats.reads);
+	stats->writes = stats_read(disk->stats.writes);
+	stats->bytes_read = stats_read(disk->stats.bytes_read);
+	stats->bytes_written = stats_read(disk->stats.bytes_written);
+	stats->bounce_copies = stats_read(disk->stats.bounce_copies);
+	stats->bounce_bytes = stats_read(disk->stats.bounce_bytes);
+}
+
+/* Return the current disk, or NULL (with an error message) if none is open */
+static struct disk *current_disk(const char *func)
+{
+	if (!current)
+		fprintf(stderr, "%s: no disk currently open\n", func);
+	return current;
+}
+
+int block_write(size_t block, const void *buf)
+{
+	return block_write_range(block, 1, buf);
+}
+
+int block_read(size_t block, void *buf)
+{
+	return block_read_range(block, 1, buf);
+}
+
+int block_write_range(size_t block, size_t count, const void *buf)
+{
+	struct disk *disk = current_disk(__func__);
+
+	return disk ? disk_write_range(disk, block, count, buf) : -1;
+}
+
+int block_read_range(size_t block, size_t count, void *buf)
+{
+	struct disk *disk = current_disk(__func__);
+
+	return disk ? disk_read_range(disk, block, count, buf) : -1;
+}
+
+int block_writev(size_t block, const struct iovec *iov, int iovcnt)
+{
+	struct disk *disk = current_disk(__func__);
+
+	return disk ? disk_writev(disk, block, iov, iovcnt) : -1;
+}
+
+int block_readv(size_t block, const struct iovec *iov, int iovcnt)
+{
+	struct disk *disk = current_disk(__func__);
+
+	return disk ? disk_readv(disk, block, iov, iovcnt) : -1;
+}
+
+void *block_map(size_t block)
+{
+	return current ? disk_map(current, block) : NULL;
+}
+
+/*
+ * Wait until request @ticket is covered by a completed sync, running the sync
+ * if no other thread is. Called with the syncer lock held.
+ */
+static int sync_ticket(struct disk *disk, unsigned long ticket)
+{
+	struct syncer *syncer = &disk->syncer;
+
+	while (syncer->completed < ticket) {
+		unsigned long target;
+		int ret;
+
+		if (syncer->running) {
+			pthread_cond_wait(&syncer->done, &syncer->lock);
+			continue;
+		}
+
+		/* Cover every request issued so far */
+		target = syncer->requested;
+		syncer->running = 1;
+		pthread_mutex_unlock(&syncer->lock);
+
+		if (disk->map)
+			ret = msync(disk->map, disk->bcount * BLOCK_SIZE,
+				    MS_SYNC);
+		else
+			ret = fdatasync(disk->fd);
+		if (ret)
+			perror(disk->map ? "msync" : "fdatasync");
+
+		pthread_mutex_lock(&syncer->lock);
+		syncer->running = 0;
+		syncer->completed = target;
+		if (ret)
+			syncer->failed = target;
+		pthread_cond_broadcast(&syncer->done);
 	}
 
-	return 0;
+	return syncer->failed >= ticket ? -1 : 0;
+}
+
+int disk_sync(struct disk *disk)
+{
+	struct syncer *syncer = &disk->syncer;
+	int ret;
+
+	pthread_mutex_lock(&syncer->lock);
+	ret = sync_ticket(disk, ++syncer->requested);
+	if (syncer->deferred_error) {
+		syncer->deferred_error = 0;
+		ret = -1;
+	}
+	pthread_mutex_unlock(&syncer->lock);
+
+	return ret;
+}
+
+int block_disk_sync(void)
+{
+	struct disk *disk = current_disk(__func__);
+
+	return disk ? disk_sync(disk) : -1;
 }
 
+static int timespec_before(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec
+		|| (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* Serve deferred requests once they are due, until the disk gets closed */
+static void *flusher_main(void *arg)
+{
+	struct disk *disk = arg;
+	struct syncer *syncer = &disk->syncer;
+
+	pthread_mutex_lock(&syncer->lock);
+	for (;;) {
+		struct timespec now;
+
+		while (!syncer->deferred && !syncer->stopping)
+			pthread_cond_wait(&syncer->wake, &syncer->lock);
+		if (!syncer->deferred)
+			break;
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		if (!syncer->stopping
+		    && timespec_before(&now, &syncer->deadline)) {
+			pthread_cond_timedwait(&syncer->wake, &syncer->lock,
+					       &syncer->deadline);
+			continue;
+		}
+
+		syncer->deferred = 0;
+		if (sync_ticket(disk, syncer->requested))
+			syncer->deferred_error = 1;
+	}
+	pthread_mutex_unlock(&syncer->lock);
+
+	return NULL;
+}
+
+static void stop_flusher(struct disk *disk)
+{
+	struct syncer *syncer = &disk->syncer;
+
+	pthread_mutex_lock(&syncer->lock);
+	if (!syncer->flusher_started) {
+		pthread_mutex_unlock(&syncer->lock);
+		return;
+	}
+	syncer->stopping = 1;
+	pthread_cond_signal(&syncer->wake);
+	pthread_mutex_unlock(&syncer->lock);
+
+	pthread_join(syncer->flusher, NULL);
+
+	pthread_mutex_lock(&syncer->lock);
+	syncer->flusher_started = 0;
+	syncer->stopping = 0;
+	pthread_mutex_unlock(&syncer->lock);
+}
+
+int disk_sync_deferred(struct disk *disk, unsigned int max_latency_ms)
+{
+	struct syncer *syncer = &disk->syncer;
+	struct timespec deadline;
+	int ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += max_latency_ms / 1000;
+	deadline.tv_nsec += (max_latency_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&syncer->lock);
+
+	if (!syncer->flusher_started) {
+		int err = pthread_create(&syncer->flusher, NULL, flusher_main,
+					 disk);
+		if (err) {
+			errno = err;
+			perror("pthread_create");
+			pthread_mutex_unlock(&syncer->lock);
+			return -1;
+		}
+		syncer->flusher_started = 1;
+	}
+
+	syncer->requested++;
+	/* The earliest deadline wins, and covers every pending request */
+	if (!syncer->deferred
+	    || timespec_before(&deadline, &syncer->deadline)) {
+		syncer->deadline = deadline;
+		syncer->deferred = 1;
+		pthread_cond_signal(&syncer->wake);
+	}
+
+	if (syncer->deferred_error) {
+		syncer->deferred_error = 0;
+		ret = -1;
+	}
+
+	pthread_mutex_unlock(&syncer->lock);
+
+	return ret;
+}
+
+int block_disk_sync_deferred(unsigned int max_latency_ms)
+{
+	struct disk *disk = current_disk(__func__);
+
+	return disk ? disk_sync_deferred(disk, max_latency_ms) : -1;
+}
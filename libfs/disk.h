@@ -2,6 +2,7 @@
 #define _DISK_H
 
 #include <stddef.h> /* for size_t definition */
+#include <sys/uio.h> /* for struct iovec definition */
 
 /** Size of a disk block in bytes */
 #define BLOCK_SIZE 4096
@@ -19,13 +20,55 @@
  */
 int block_disk_open(const char *diskname);
 
+/**
+ * block_disk_open_mmap - Open virtual disk file and map it in memory
+ * @diskname: Name of the virtual disk file
+ *
+ * Same as block_disk_open(), but the whole virtual disk file is mapped in
+ * memory. Block reads and writes become plain memory copies, and block_map()
+ * gives direct access to the blocks. The mapping is synchronized with the file
+ * when the disk is closed.
+ *
+ * Return: -1 if @diskname is invalid, if the virtual disk file cannot be opened
+ * or mapped, or is already open. 0 otherwise.
+ */
+int block_disk_open_mmap(const char *diskname);
+
 /**
  * block_disk_close - Close virtual disk file
  *
- * Return: -1 if there was no virtual disk file opened. 0 otherwise.
+ * Return: -1 if there was no virtual disk file opened, if a deferred sync
+ * failed, or if a memory mapping of the virtual disk file could not be
+ * synchronized with it. 0 otherwise.
  */
 int block_disk_close(void);
 
+/**
+ * block_disk_sync - Make the virtual disk durable
+ *
+ * Wait until every block written to the virtual disk so far has reached stable
+ * storage. Concurrent calls are coalesced: a single fdatasync() (or msync() for
+ * a mapped disk) covers every call issued before it starts.
+ *
+ * Return: -1 if there was no virtual disk file opened, or if the sync or a
+ * previously deferred one failed. 0 otherwise.
+ */
+int block_disk_sync(void);
+
+/**
+ * block_disk_sync_deferred - Make the virtual disk durable within a deadline
+ * @max_latency_ms: Maximum delay before the sync, in milliseconds
+ *
+ * Same as block_disk_sync(), but do not wait: a background thread runs the
+ * sync at most @max_latency_ms milliseconds later, and that sync covers every
+ * deferred request pending by then. Pending requests are served before the disk
+ * is closed.
+ *
+ * Return: -1 if there was no virtual disk file opened, if the background thread
+ * cannot be started, or if a previously deferred sync failed. 0 otherwise.
+ */
+int block_disk_sync_deferred(unsigned int max_latency_ms);
+
 /**
  * block_disk_count - Get disk's block count
  *
@@ -60,5 +103,294 @@ int block_write(size_t block, const void *buf);
  */
 int block_read(size_t block, void *buf);
 
+/**
+ * block_write_range - Write consecutive blocks to disk
+ * @block: Index of the first block to write to
+ * @count: Number of blocks to write
+ * @buf: Data buffer to write in the blocks
+ *
+ * Write the content of buffer @buf (@count times %BLOCK_SIZE bytes) in the
+ * virtual disk's blocks @block to @block + @count - 1, using a single system
+ * call whenever possible.
+ *
+ * Return: -1 if one of the blocks is out of bounds or inaccessible or if the
+ * writing operation fails. 0 otherwise.
+ */
+int block_write_range(size_t block, size_t count, const void *buf);
+
+/**
+ * block_read_range - Read consecutive blocks from disk
+ * @block: Index of the first block to read from
+ * @count: Number of blocks to read
+ * @buf: Data buffer to be filled with content of blocks
+ *
+ * Read the content of virtual disk's blocks @block to @block + @count - 1
+ * (@count times %BLOCK_SIZE bytes) into buffer @buf, using a single system call
+ * whenever possible.
+ *
+ * Return: -1 if one of the blocks is out of bounds or inaccessible, or if the
+ * reading operation fails. 0 otherwise.
+ */
+int block_read_range(size_t block, size_t count, void *buf);
+
+/**
+ * block_writev - Gather consecutive blocks to disk
+ * @block: Index of the first block to write to
+ * @iov: Array of data buffers to write in the blocks
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Write the buffers described by @iov, one after the other, in consecutive
+ * virtual disk blocks starting at @block. The length of each buffer must be a
+ * multiple of %BLOCK_SIZE.
+ *
+ * Return: -1 if @iov is invalid, if one of the blocks is out of bounds or
+ * inaccessible, or if the writing operation fails. 0 otherwise.
+ */
+int block_writev(size_t block, const struct iovec *iov, int iovcnt);
+
+/**
+ * block_readv - Scatter consecutive blocks from disk
+ * @block: Index of the first block to read from
+ * @iov: Array of data buffers to be filled with content of blocks
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Read consecutive virtual disk blocks starting at @block into the buffers
+ * described by @iov, one after the other. The length of each buffer must be a
+ * multiple of %BLOCK_SIZE.
+ *
+ * Return: -1 if @iov is invalid, if one of the blocks is out of bounds or
+ * inaccessible, or if the reading operation fails. 0 otherwise.
+ */
+int block_readv(size_t block, const struct iovec *iov, int iovcnt);
+
+/**
+ * block_map - Get direct access to a block
+ * @block: Index of the block
+ *
+ * Return: NULL if no disk is open, if the disk was not opened with
+ * block_disk_open_mmap(), or if @block is out of bounds. Otherwise, the address
+ * where the %BLOCK_SIZE bytes of block @block are mapped in memory.
+ */
+void *block_map(size_t block);
+
+/*
+ * Instance API: the block_* functions above operate on the single currently
+ * open virtual disk. The disk_* functions below do the same on an explicit disk
+ * instance, so that several virtual disks can be open at once.
+ */
+
+/* Opaque virtual disk instance */
+struct disk;
+
+/** Disk instance statistics */
+struct disk_stats {
+	/* Read and write requests, whichever call issued them */
+	size_t reads;
+	size_t writes;
+	/* Bytes moved by these requests */
+	size_t bytes_read;
+	size_t bytes_written;
+	/* Copies to or from a file descriptor done through a bounce buffer */
+	size_t bounce_copies;
+	size_t bounce_bytes;
+};
+
+/**
+ * disk_open - Open virtual disk file as a new instance
+ * @diskname: Name of the virtual disk file
+ * @use_mmap: Whether to map the whole virtual disk file in memory
+ *
+ * Same as block_disk_open(), or block_disk_open_mmap() if @use_mmap is set, but
+ * the disk is not made the current one.
+ *
+ * Return: NULL if @diskname is invalid, or if the virtual disk file cannot be
+ * opened or mapped. The disk instance otherwise.
+ */
+struct disk *disk_open(const char *diskname, int use_mmap);
+
+/**
+ * disk_create - Create virtual disk file as a new instance
+ * @diskname: Name of the virtual disk file
+ * @bcount: Number of blocks of the virtual disk
+ * @sparse: Whether to leave the blocks unallocated on the host
+ *
+ * Create virtual disk file @diskname, or truncate it if it already exists, to
+ * @bcount blocks of zeros, without writing them. Unless @sparse is set, the
+ * host file system allocates the whole file upfront (see posix_fallocate(3)).
+ * The new disk is then opened as with disk_open(), without mapping it.
+ *
+ * Return: NULL if @diskname or @bcount is invalid, or if the virtual disk file
+ * cannot be created or sized. The disk instance otherwise.
+ */
+struct disk *disk_create(const char *diskname, size_t bcount, int sparse);
+
+/**
+ * disk_close - Close virtual disk instance
+ * @disk: Disk instance
+ *
+ * Return: -1 if a deferred sync failed, or if the memory mapping of @disk
+ * could not be synchronized with the virtual disk file. 0 otherwise.
+ */
+int disk_close(struct disk *disk);
+
+/**
+ * disk_count - Get the block count of a disk instance
+ * @disk: Disk instance
+ *
+ * Return: the number of blocks that @disk contains.
+ */
+size_t disk_count(struct disk *disk);
+
+/**
+ * disk_write_range - Write consecutive blocks to a disk instance
+ * @disk: Disk instance
+ * @block: Index of the first block to write to
+ * @count: Number of blocks to write
+ * @buf: Data buffer to write in the blocks
+ *
+ * Same as block_write_range(), on @disk.
+ *
+ * Return: -1 if one of the blocks is out of bounds or inaccessible or if the
+ * writing operation fails. 0 otherwise.
+ */
+int disk_write_range(struct disk *disk, size_t block, size_t count,
+		     const void *buf);
+
+/**
+ * disk_read_range - Read consecutive blocks from a disk instance
+ * @disk: Disk instance
+ * @block: Index of the first block to read from
+ * @count: Number of blocks to read
+ * @buf: Data buffer to be filled with content of blocks
+ *
+ * Same as block_read_range(), on @disk.
+ *
+ * Return: -1 if one of the blocks is out of bounds or inaccessible, or if the
+ * reading operation fails. 0 otherwise.
+ */
+int disk_read_range(struct disk *disk, size_t block, size_t count, void *buf);
+
+/**
+ * disk_writev - Gather consecutive blocks to a disk instance
+ * @disk: Disk instance
+ * @block: Index of the first block to write to
+ * @iov: Array of data buffers to write in the blocks
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Same as block_writev(), on @disk.
+ *
+ * Return: -1 if @iov is invalid, if one of the blocks is out of bounds or
+ * inaccessible, or if the writing operation fails. 0 otherwise.
+ */
+int disk_writev(struct disk *disk, size_t block, const struct iovec *iov,
+		int iovcnt);
+
+/**
+ * disk_readv - Scatter consecutive blocks from a disk instance
+ * @disk: Disk instance
+ * @block: Index of the first block to read from
+ * @iov: Array of data buffers to be filled with content of blocks
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Same as block_readv(), on @disk.
+ *
+ * Return: -1 if @iov is invalid, if one of the blocks is out of bounds or
+ * inaccessible, or if the reading operation fails. 0 otherwise.
+ */
+int disk_readv(struct disk *disk, size_t block, const struct iovec *iov,
+	       int iovcnt);
+
+/**
+ * disk_map - Get direct access to a block of a disk instance
+ * @disk: Disk instance
+ * @block: Index of the block
+ *
+ * Return: NULL if @disk is not mapped in memory, or if @block is out of bounds.
+ * Otherwise, the address where block @block is mapped in memory.
+ */
+void *disk_map(struct disk *disk, size_t block);
+
+/**
+ * disk_fd - Get the file descriptor of a disk instance
+ * @disk: Disk instance
+ *
+ * The descriptor stays owned by @disk. It lets other I/O interfaces (e.g.,
+ * asynchronous ones) access the virtual disk file directly, which remains
+ * coherent with a memory mapping of it.
+ *
+ * Return: the file descriptor of the virtual disk file of @disk.
+ */
+int disk_fd(struct disk *disk);
+
+/**
+ * disk_copy_out - Copy bytes from a disk instance to a file descriptor
+ * @disk: Disk instance
+ * @block: Index of the block holding the first byte
+ * @offset: Offset of the first byte within @block
+ * @fd: Destination file descriptor, written at its current file position
+ * @len: Number of bytes to copy
+ *
+ * The bytes are moved by the kernel with copy_file_range(), or sendfile() or
+ * splice() when @fd does not support it (e.g., a socket or a pipe), without
+ * going through user space. Only if none of them applies are they copied
+ * through a bounce buffer. A mapped disk is copied from its file, which is
+ * coherent with the mapping.
+ *
+ * Return: -1 if the bytes are out of bounds, or if reading from the disk or
+ * writing to @fd fails. 0 otherwise.
+ */
+int disk_copy_out(struct disk *disk, size_t block, size_t offset, int fd,
+		  size_t len);
+
+/**
+ * disk_copy_in - Copy bytes from a file descriptor to a disk instance
+ * @disk: Disk instance
+ * @block: Index of the block receiving the first byte
+ * @offset: Offset of the first byte within @block
+ * @fd: Source file descriptor, read from its current file position
+ * @len: Number of bytes to copy
+ *
+ * Same as disk_copy_out(), the other way around, with copy_file_range() or
+ * splice().
+ *
+ * Return: -1 if the bytes are out of bounds, or if reading from @fd or writing
+ * to the disk fails. Otherwise, the number of bytes copied, which is less than
+ * @len only if the end of the data of @fd is reached.
+ */
+ssize_t disk_copy_in(struct disk *disk, size_t block, size_t offset, int fd,
+		     size_t len);
+
+/**
+ * disk_get_stats - Get disk instance statistics
+ * @disk: Disk instance
+ * @stats: Statistics to be filled
+ *
+ * The statistics are only maintained if libfs is built with FS_STATS. They
+ * are all 0 otherwise.
+ */
+void disk_get_stats(struct disk *disk, struct disk_stats *stats);
+
+/**
+ * disk_sync - Make a disk instance durable
+ * @disk: Disk instance
+ *
+ * Same as block_disk_sync(), on @disk.
+ *
+ * Return: -1 if the sync or a previously deferred one failed. 0 otherwise.
+ */
+int disk_sync(struct disk *disk);
+
+/**
+ * disk_sync_deferred - Make a disk instance durable within a deadline
+ * @disk: Disk instance
+ * @max_latency_ms: Maximum delay before the sync, in milliseconds
+ *
+ * Same as block_disk_sync_deferred(), on @disk.
+ *
+ * Return: -1 if the background thread cannot be started, or if a previously
+ * deferred sync failed. 0 otherwise.
+ */
+int disk_sync_deferred(struct disk *disk, unsigned int max_latency_ms);
+
 #endif /* _DISK_H */
 
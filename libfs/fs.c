@@ -1,11 +1,18 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
 
+#include "aio.h"
+#include "cache.h"
 #include "disk.h"
 #include "fs.h"
+#include "journal.h"
+#include "stats.h"
+#include "trace.h"
 
 struct superblock
 {
@@ -15,13 +22,31 @@ struct superblock
 	uint16_t data_block_start_index; // Data block start index
 	uint16_t data_blocks_count;		 // Amount of data blocks
 	uint8_t total_FAT_blocks;		 // Number of blocks for FAT
-	uint8_t padding[4079];			 // Unused/Padding
+	char journal_signature[8];		 // JOURNAL_SIGNATURE if the file system has a journal
+	uint16_t journal_start;			 // Journal region first block index
+	uint16_t journal_blocks;		 // Number of blocks in the journal region
+	char index_signature[8];		 // INDEX_SIGNATURE if the file system has a reserved index region
+	uint16_t index_start;			 // Index region first block index
+	uint16_t index_blocks;			 // Number of blocks in the index region
+	uint8_t padding[4055];			 // Unused/Padding
 } __attribute__((packed));
 
+#define JOURNAL_SIGNATURE "ECSJRNL1"
+#define INDEX_SIGNATURE "ECSINDX1"
+#define JOURNAL_GROUP_UPDATES 64 // Metadata updates committed together by the journal
+
 #define FAT_EOC 0xFFFF			   // End-of-Chain value
 #define FAT_ENTRIES_PER_BLOCK 2048 // Number of FAT entries per block
 
-uint16_t *FAT; // pointer to FAT array
+#define BLOCKS(n) (((n) + BLOCK_SIZE - 1) / BLOCK_SIZE) // Number of blocks needed to hold @n bytes
+
+#define DIR_HASH_SIZE (2 * FS_FILE_MAX_COUNT) // must be a power of two
+#define DIR_HASH_EMPTY -1
+
+#define READAHEAD_MIN 4	 // Readahead window on the first sequential read, in blocks
+#define READAHEAD_MAX 64 // Largest readahead window, in blocks
+
+#define COPY_EXTENT_MAX 256 // Largest extent allocated at once by fs_copy_from_fd, in blocks
 
 /* Root Directory data structure */
 struct root_dir_entry
@@ -34,8 +59,25 @@ struct root_dir_entry
 
 struct file
 {
-	char filename[FS_FILENAME_LEN];
+	struct root_dir_entry *entry;	// root directory entry of the file, NULL if the fd is free
 	size_t offset;
+	/* Last data block accessed through this fd, so that sequential accesses do
+	 * not walk the FAT chain from its head */
+	uint16_t cursor_block;	// FAT_EOC when unknown
+	size_t cursor_index;	// position of @cursor_block in the chain
+	/* Data blocks of the first @block_map_len positions of the chain, built on
+	 * the first random access so that seeks do not walk the FAT chain */
+	uint16_t *block_map;
+	size_t block_map_len;
+	size_t block_map_size;
+	size_t async_inflight;	// asynchronous requests in flight on this fd
+	size_t maps;	// fs_read_map() mappings not released yet
+	/* Sequential readahead: where a sequential read would start, the
+	 * current window in blocks (0 on random accesses), and the chain
+	 * position up to which blocks were prefetched */
+	size_t ra_offset;
+	size_t ra_window;
+	size_t ra_end;
 };
 
 struct fd_table
@@ -50,662 +92,2860 @@ struct root_directory
 	int total_opened;
 };
 
-/* Global variables to used in the file system */
-static int fs_mounted = 0;
-static struct superblock sb; // superblock of the mounter file system
-static struct fd_table fd_table;
-struct root_directory root_dir;
+/* Mounted file system instance */
+struct fs
+{
+	struct disk *disk;
+	struct superblock sb; // superblock of the mounted file system
+	uint16_t *FAT; // pointer to FAT array
+	struct root_directory root_dir;
+	struct fd_table fd_table;
+
+	/* Hash index of the root directory: open-addressed table with linear
+	 * probing, mapping filenames to root directory entries. Kept in sync by
+	 * fs_create and fs_delete. */
+	int16_t dir_hash[DIR_HASH_SIZE];
+
+	/* Free data block bitmap, kept in sync with the FAT: bit i is set when
+	 * FAT[i] is free. Allocation is next-fit, starting from where the last one
+	 * stopped. */
+	uint64_t *free_map;
+	size_t free_map_words;
+	size_t free_blocks;	// number of bits set in @free_map
+	uint16_t alloc_cursor;	// where the next allocation starts searching
+
+	/* Block cache sitting between the file system and the virtual disk */
+	struct cache *cache;
+	size_t cache_blocks;	// capacity, taken from the global cache budget
+
+	/* Metadata blocks modified since they were last written back */
+	int sb_dirty;
+	uint8_t FAT_dirty[UINT8_MAX + 1]; // one flag per FAT block
+	int root_dir_dirty;
+
+	/* Metadata journal, NULL if the file system has none */
+	struct journal *journal;
+	int pending_updates;	// metadata updates not committed yet
+
+	/*
+	 * Locks, acquired in this order:
+	 * - dir_lock protects the root directory and its hash index. File
+	 *   operations hold it for reading, which keeps their entry in place, and
+	 *   creating or deleting a file holds it for writing. Writing back the
+	 *   metadata holds it for writing as well, to get a consistent snapshot.
+	 * - file_locks serialize the operations on a file (its content, its size
+	 *   and its open file descriptors), one per root directory entry.
+	 *   Positional reads hold it for reading, and leave the fd alone, so
+	 *   that they run in parallel.
+	 * - alloc_lock protects the FAT, the free block bitmap and the dirty
+	 *   metadata flags, unless dir_lock is held for writing.
+	 * - fd_lock protects the allocation of file descriptors.
+	 */
+	pthread_rwlock_t dir_lock;
+	pthread_rwlock_t file_locks[FS_FILE_MAX_COUNT];
+	pthread_mutex_t alloc_lock;
+	pthread_mutex_t fd_lock;
+
+	/* Asynchronous I/O engine, started by the first asynchronous request.
+	 * async_lock is a leaf lock protecting it, the requests in flight and
+	 * their count in each open file. */
+	struct aio *aio;
+	size_t async_inflight;
+	pthread_mutex_t async_lock;
+	pthread_cond_t async_done; // signaled when an asynchronous request completes
+
+	/* Instrumentation, updated with stats_add() (see fs_stats) */
+	struct
+	{
+		size_t fat_hops;
+		size_t dir_lookups;
+		size_t allocations;
+		size_t blocks_allocated;
+		size_t bounce_copies;
+		size_t bounce_bytes;
+		struct stats_histogram ops[FS_STATS_OPS];
+	} stats;
+
+	/* Trace of the calls, NULL unless recording (see fs_trace_start).
+	 * trace_lock is a leaf lock keeping it alive while a call is appended. */
+	struct trace *trace;
+	uint64_t trace_start; // when recording started, in nanoseconds
+	pthread_mutex_t trace_lock;
+};
 
-/* TODO: Phase 1 */
+/* Asynchronous fs_read/fs_write request */
+struct async_request
+{
+	struct fs *fs;
+	struct file *f;
+	int fd;
+	fs_async_callback_t callback;
+	void *arg;
+	int bytes;		// bytes transferred once every block request completes
+	int failed;		// whether a block request failed
+	size_t pending;	// block requests in flight, plus one while submitting
+};
 
-int fs_mount(const char *diskname)
+/* Run of consecutive blocks transferred in the background for a request */
+struct async_blocks
 {
-	// printf("...fs_mount() initalize\n");
-	/* TODO: Phase 1 */
-	/* Opening virtual disk file */
-	if (block_disk_open(diskname) == -1)
-		return -1;
+	struct async_request *req;
+	int write;
+	size_t block;
+	size_t count;
+	void *buf;
+};
 
-	/* Read the superblock */
-	if (block_read(0, &sb) == -1)
-		return -1;
+/* File system used by the calls without a handle, NULL if none is mounted */
+static fs_t *default_fs;
 
-	/* Verify the signature of the file system */
-	if (strncmp((char *)sb.signature, "ECS150FS", 8) != 0)
-		return -1; // Incorrect signature
+/* Block cache capacity requested by the next mounts */
+static size_t cache_blocks = FS_CACHE_DEFAULT_BLOCKS;
 
-	/* verify the size of the virtual disk and the block size */
-	if (block_disk_count() != sb.total_disk_blocks)
-		return -1; // Currently open disk does not match SB block count
+/* Blocks that the caches of all the mounted file systems may hold together,
+ * and blocks they currently hold */
+static size_t cache_budget = SIZE_MAX;
+static size_t cache_budget_used;
+static pthread_mutex_t cache_budget_lock = PTHREAD_MUTEX_INITIALIZER;
 
-	/* Allocate memory for the FAT table and read it from disk */
-	// init_FAT(sb.data_blocks_count);
-	FAT = (uint16_t*)malloc(sb.data_blocks_count * BLOCK_SIZE * sizeof(uint16_t)); // allocating memory for FAT
-	// FAT = (uint16_t *)malloc(sb.data_blocks_count * sizeof(uint16_t)); //"There are as many entries as data blocks in the disk"
+/* Maximum delay before fs_fsync() makes the disk durable, 0 to wait for it */
+static unsigned int sync_latency_ms;
 
-	if (FAT == NULL)
-		return -1; // Memory allocation for FAT failed
+/* Configuration of the asynchronous I/O engines started by the next mounts */
+static unsigned int async_depth = FS_ASYNC_DEFAULT_DEPTH;
+static int async_flags;
+/* Update FAT entry @index, remembering that its FAT block must be written back */
+static void set_FAT(struct fs *fs, uint16_t index, uint16_t value)
+{
+	fs->FAT[index] = value;
+	fs->FAT_dirty[index / FAT_ENTRIES_PER_BLOCK] = 1;
+}
 
-	for (int i = 0 ; i < sb.root_dir_index; i++)
-	{
-		if (block_read( i +1 , FAT + (i) * BLOCK_SIZE ) == -1)
-		{
-			free(FAT);
-			return -1;
-		}
-	}
+/* Return the FAT entry of @block, i.e. the next data block in its chain */
+static uint16_t fat_next(struct fs *fs, uint16_t block)
+{
+	stats_add(fs->stats.fat_hops, 1);
+	return fs->FAT[block];
+}
 
-	if (FAT[0] != FAT_EOC)
-	{
-		// First entry is not 0xFFFF
-		return -1;
-	}
+_Static_assert(STATS_BUCKETS == FS_STATS_BUCKETS, "histogram geometry mismatch");
 
-	/* Read the root direcory from disk */
-	if (block_read(sb.root_dir_index, root_dir.root_dir_entries) == -1)
-	{
-		free(FAT);
-		return -1;
-	}
+/* Time the rest of the calling fs_* function as operation @op of @fs */
+#define TIME_OP(fs, op) STATS_TIMER((fs) != NULL ? &(fs)->stats.ops[op] : NULL)
 
-	// printf("fs_mount() exiting...\n");
-	fs_mounted = 1;
-	return 0;
+/* Current time in nanoseconds if @fs is recording a trace, 0 otherwise */
+static uint64_t trace_begin(struct fs *fs)
+{
+	if (fs == NULL || __atomic_load_n(&fs->trace, __ATOMIC_ACQUIRE) == NULL)
+		return 0;
+	return stats_clock();
 }
 
-int fs_umount(void)
+/*
+ * Append the call @op started at @start (see trace_begin) to the trace of @fs,
+ * with its return value @ret and its arguments. @fd is -1 for calls without a
+ * file descriptor, and @filename NULL for calls without a filename.
+ */
+static void trace_call(struct fs *fs, uint64_t start, int op, int ret, int fd, size_t count, size_t offset, const char *filename)
 {
-	// printf("...fs_unmount() intialize\n");
-	/* checking if the file system is mounted*/
-	if (!fs_mounted)
-		return -1;
-
-	if(fd_table.total_opened > 0)
+	if (start == 0)
+		return;
+
+	uint64_t end = trace_begin(fs);
+	struct fs_trace_record rec = {
+		.duration_ns = end - start > UINT32_MAX ? UINT32_MAX : end - start,
+		.count = count > UINT32_MAX ? UINT32_MAX : count,
+		.offset = offset > UINT32_MAX ? UINT32_MAX : offset,
+		.ret = ret,
+		.fd = fd,
+		.op = op,
+		.name_len = filename == NULL ? 0 : strnlen(filename, UINT8_MAX),
+	};
+
+	pthread_mutex_lock(&fs->trace_lock);
+	if (fs->trace != NULL && start >= fs->trace_start)
 	{
-		//still open fd
-		return -1;
+		rec.start_ns = start - fs->trace_start;
+		trace_append(fs->trace, &rec, sizeof(rec), filename, rec.name_len);
 	}
+	pthread_mutex_unlock(&fs->trace_lock);
+}
 
-	/* Rewriting Superblock back to disk */
-	if (block_write(0, &sb) == -1)
+/* FNV-1a hash of @filename, truncated to the size of the hash index */
+static size_t hash_filename(const char *filename)
+{
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < FS_FILENAME_LEN && filename[i] != '\0'; i++)
 	{
-		// failed to rewrite superblock back to disk
-		return -1;
+		hash ^= (uint8_t)filename[i];
+		hash *= 16777619u;
 	}
+	return hash & (DIR_HASH_SIZE - 1);
+}
 
-	/* Write FAT table and root directory back to disk */
-	for (int i = 0; i < sb.total_FAT_blocks; i++)
+/* Return the root directory entry index of @filename, or -1 if there is none */
+static int dir_lookup(struct fs *fs, const char *filename)
+{
+	stats_add(fs->stats.dir_lookups, 1);
+	for (size_t h = hash_filename(filename); fs->dir_hash[h] != DIR_HASH_EMPTY; h = (h + 1) & (DIR_HASH_SIZE - 1))
 	{
-		if (block_write(i + 1, FAT + i * BLOCK_SIZE) == -1)
-			return -1;
+		if (strncmp(fs->root_dir.root_dir_entries[fs->dir_hash[h]].filename, filename, FS_FILENAME_LEN) == 0)
+			return fs->dir_hash[h];
 	}
-	if (block_write(sb.root_dir_index, root_dir.root_dir_entries) == -1)
-		return -1;
+	return -1;
+}
 
-	fs_mounted = 0;
-	// free(FAT);
-	return block_disk_close();
+static void dir_hash_insert(struct fs *fs, int i)
+{
+	size_t h = hash_filename(fs->root_dir.root_dir_entries[i].filename);
+	while (fs->dir_hash[h] != DIR_HASH_EMPTY)
+		h = (h + 1) & (DIR_HASH_SIZE - 1);
+	fs->dir_hash[h] = i;
 }
 
-int fs_info(void)
+/* Remove entry index @i, shifting back the entries probed after it */
+static void dir_hash_remove(struct fs *fs, int i)
 {
-	if(!fs_mounted)
-	{
-		//no disk mounted
-		return -1;
-	}
+	size_t hole = hash_filename(fs->root_dir.root_dir_entries[i].filename);
+	while (fs->dir_hash[hole] != i)
+		hole = (hole + 1) & (DIR_HASH_SIZE - 1);
 
-	printf("FS Info:\n"
-		   "total_blk_count=%d\n"
-		   "fat_blk_count=%d\n"
-		   "rdir_blk=%d\n"
-		   "data_blk=%d\n"
-		   "data_blk_count=%d\n",
-		   sb.total_disk_blocks, sb.total_FAT_blocks, sb.root_dir_index, sb.data_block_start_index, sb.data_blocks_count);
-	int fat_free = 0;
-	for (int i = 0; i < sb.data_blocks_count; i++) // subtract 1 if FAT_EOC doesn't count
+	for (size_t h = (hole + 1) & (DIR_HASH_SIZE - 1); fs->dir_hash[h] != DIR_HASH_EMPTY; h = (h + 1) & (DIR_HASH_SIZE - 1))
 	{
-		if (FAT[i] == 0)
-			fat_free++;
-	}
-	printf("fat_free_ratio=%d/%d\n", fat_free, sb.data_blocks_count);
-	int root_free = 0;
-	for (int i = 0; i < FS_FILE_MAX_COUNT; i++)
-	{
-		if (root_dir.root_dir_entries[i].filename[0] == '\0')
-			root_free++;
+		size_t home = hash_filename(fs->root_dir.root_dir_entries[fs->dir_hash[h]].filename);
+		/* Entry at @h can fill the hole unless its home lies in (hole, h] */
+		if (((h - home) & (DIR_HASH_SIZE - 1)) >= ((h - hole) & (DIR_HASH_SIZE - 1)))
+		{
+			fs->dir_hash[hole] = fs->dir_hash[h];
+			hole = h;
+		}
 	}
-	printf("rdir_free_ratio=%d/%d\n", root_free, FS_FILE_MAX_COUNT);
-	return 0;
+	fs->dir_hash[hole] = DIR_HASH_EMPTY;
 }
 
-int fs_create(const char *filename)
+/* Build the hash index from the root directory, and count the files */
+static void build_dir_hash(struct fs *fs)
 {
-	/* check if FS is mounted */
-	if (!fs_mounted)
-		return -1;
+	for (int h = 0; h < DIR_HASH_SIZE; h++)
+		fs->dir_hash[h] = DIR_HASH_EMPTY;
 
-	if (filename == NULL)
-	{
-		// no filename provided
-		return -1;
-	}
-	if (strlen(filename) > FS_FILENAME_LEN)
+	fs->root_dir.total_opened = 0;
+	for (int i = 0; i < FS_FILE_MAX_COUNT; i++)
 	{
-		// filename too long
-		return -1;
+		if (fs->root_dir.root_dir_entries[i].filename[0] != '\0')
+		{
+			dir_hash_insert(fs, i);
+			fs->root_dir.total_opened++;
+		}
 	}
-	if(root_dir.total_opened == FS_FILE_MAX_COUNT)
-	{
-		//max files created
+}
+
+/* Build the free data block bitmap from the FAT */
+static int build_free_map(struct fs *fs)
+{
+	fs->free_map_words = (fs->sb.data_blocks_count + 63) / 64;
+	fs->free_map = calloc(fs->free_map_words, sizeof(uint64_t));
+	if (fs->free_map == NULL)
 		return -1;
-	}
 
-	int freeEntry = -1;							// keep track of the first freeEntry in the directory
-	int pollingFlag = 1;						// flag to determine whether or not we're still looking for a freeEntry
-	for (int i = 0; i < FS_FILE_MAX_COUNT; i++) // Purpose: check if filename already exists but also find first free entry
+	fs->free_blocks = 0;
+	for (uint16_t i = 0; i < fs->sb.data_blocks_count; i++)
 	{
-		if (root_dir.root_dir_entries[i].filename[0] == '\0' && pollingFlag) // if we found a freeEntry
-		{
-			freeEntry = i;	 // take the index
-			pollingFlag = 0; // no longer polling for freeEntry
-			break;
-		}
-		if (strcmp((char *)root_dir.root_dir_entries[i].filename, filename) == 0)
+		if (fs->FAT[i] == 0)
 		{
-			// file already exists within directory
-			return -1;
+			fs->free_map[i / 64] |= 1ULL << (i % 64);
+			fs->free_blocks++;
 		}
 	}
-	if (freeEntry < 0)
-	{
-		// directory is full
-		return -1;
-	}
-	else
-	{
-		memcpy(root_dir.root_dir_entries[freeEntry].filename, filename, FS_FILENAME_LEN);
-		root_dir.root_dir_entries[freeEntry].size = 0;
-		root_dir.root_dir_entries[freeEntry].first_datablock_index = FAT_EOC;
-	}
-	root_dir.total_opened++;
+	fs->alloc_cursor = 0;
 	return 0;
 }
 
-int fs_delete(const char *filename)
+/* Mark FAT entry @index as free, in both the FAT and the bitmap */
+static void free_data_block(struct fs *fs, uint16_t index)
 {
-	// TODO: if file @filename is currently open
-	// Loop through fd_table for filename
-	// If loop passes through, file is not open
-
-	if (!fs_mounted)
-		return -1;
-
-	if (filename == NULL || strlen(filename) > FS_FILENAME_LEN)
-	{
-		// provided invalid file name
-		return -1;
-	}
+	set_FAT(fs, index, 0);
+	fs->free_map[index / 64] |= 1ULL << (index % 64);
+	fs->free_blocks++;
+}
 
-	int i = 0;
-	while (strcmp(root_dir.root_dir_entries[i].filename, filename) != 0 && i <= FS_FILE_MAX_COUNT)
-		i++;
-	if (i > FS_FILE_MAX_COUNT - 1)
-	{
-		// File not found
-		return -1;
-	}
-	uint16_t index = root_dir.root_dir_entries[i].first_datablock_index;
-	root_dir.root_dir_entries[i].filename[0] = '\0';
-	root_dir.root_dir_entries[i].size = 0;
-	root_dir.root_dir_entries[i].first_datablock_index = FAT_EOC;
+/* Take up to @want blocks from the global cache budget, return how many were granted */
+static size_t cache_budget_take(size_t want)
+{
+	pthread_mutex_lock(&cache_budget_lock);
+	size_t left = cache_budget > cache_budget_used ? cache_budget - cache_budget_used : 0;
+	size_t got = want < left ? want : left;
+	cache_budget_used += got;
+	pthread_mutex_unlock(&cache_budget_lock);
+	return got;
+}
 
-	block_write(sb.root_dir_index, root_dir.root_dir_entries);
+static void cache_budget_release(size_t blocks)
+{
+	pthread_mutex_lock(&cache_budget_lock);
+	cache_budget_used -= blocks;
+	pthread_mutex_unlock(&cache_budget_lock);
+}
 
-	// clear FAT chain
-	while (index != FAT_EOC)
-	{
-		uint16_t next = FAT[index];
-		FAT[index] = 0;
-		index = next;
-	}
-	root_dir.total_opened--;
-	return 0;
+/* Release everything held by @fs, which may be partially set up */
+static void release_fs(struct fs *fs)
+{
+	aio_destroy(fs->aio);
+	if (fs->journal != NULL)
+		journal_close(fs->journal, 0);
+	cache_destroy(fs->cache);
+	cache_budget_release(fs->cache_blocks);
+	free(fs->FAT);
+	free(fs->free_map);
+	if (fs->disk != NULL)
+		disk_close(fs->disk);
+
+	pthread_rwlock_destroy(&fs->dir_lock);
+	for (int i = 0; i < FS_FILE_MAX_COUNT; i++)
+		pthread_rwlock_destroy(&fs->file_locks[i]);
+	pthread_mutex_destroy(&fs->alloc_lock);
+	pthread_mutex_destroy(&fs->fd_lock);
+	pthread_mutex_destroy(&fs->async_lock);
+	pthread_cond_destroy(&fs->async_done);
+	if (fs->trace != NULL)
+		trace_close(fs->trace);
+	pthread_mutex_destroy(&fs->trace_lock);
+	free(fs);
 }
 
-int fs_ls(void)
+static fs_t *mount(const char *diskname, int use_mmap)
 {
-	if (!fs_mounted)
-	{
-		// not mounted
-		return -1;
-	}
+	struct fs *fs = calloc(1, sizeof(struct fs));
+	if (fs == NULL)
+		return NULL;
 
-	printf("FS ls:\n");
+	pthread_rwlock_init(&fs->dir_lock, NULL);
 	for (int i = 0; i < FS_FILE_MAX_COUNT; i++)
+		pthread_rwlock_init(&fs->file_locks[i], NULL);
+	pthread_mutex_init(&fs->alloc_lock, NULL);
+	pthread_mutex_init(&fs->fd_lock, NULL);
+	pthread_mutex_init(&fs->async_lock, NULL);
+	pthread_cond_init(&fs->async_done, NULL);
+	pthread_mutex_init(&fs->trace_lock, NULL);
+
+	/* Opening virtual disk file */
+	fs->disk = disk_open(diskname, use_mmap);
+	if (fs->disk == NULL)
 	{
-		if (root_dir.root_dir_entries[i].filename[0] != '\0')
-			printf("file: %s, size: %d, data_blk: %d\n", root_dir.root_dir_entries[i].filename, root_dir.root_dir_entries[i].size, root_dir.root_dir_entries[i].first_datablock_index);
+		release_fs(fs);
+		return NULL;
 	}
-	return 0;
-}
-
-int fs_open(const char *filename) // do we not have to check if the file is already open?
-{
-	if (!fs_mounted)
-		return -1;
 
-	if (filename == NULL || strlen(filename) == 0 || strlen(filename) > FS_FILENAME_LEN)
+	/* Read the superblock */
+	if (disk_read_range(fs->disk, 0, 1, &fs->sb) == -1)
 	{
-		//invalid filename
-		return -1; 
+		release_fs(fs);
+		return NULL;
 	}
 
-	/* check if there is already a file with the same name opened */
-	for(int i = 0; i < fd_table.total_opened; i++)
+	/* Verify the signature of the file system */
+	if (strncmp((char *)fs->sb.signature, "ECS150FS", 8) != 0)
 	{
-		if(strcmp(fd_table.files[i].filename, filename) == 0)
-			return -1;
+		release_fs(fs);
+		return NULL; // Incorrect signature
 	}
 
-	/* check if there is room to open another file */
-	if (fd_table.total_opened == FS_OPEN_MAX_COUNT)
+	/* verify the size of the virtual disk and the block size */
+	if (disk_count(fs->disk) != fs->sb.total_disk_blocks)
 	{
-		// max files opened
-		return -1;
+		release_fs(fs);
+		return NULL; // Currently open disk does not match SB block count
 	}
-	int j = 0;
 
-	/*Find whether the file exists*/
-	// printf("root_dir.total_opened: %d\n", fd_table.total_opened);
-	if(fd_table.total_opened > 0)
+	/* Complete the last metadata transaction if it was interrupted, which may
+	 * bring a newer superblock */
+	if (strncmp(fs->sb.journal_signature, JOURNAL_SIGNATURE, 8) == 0)
 	{
-		int i = 0;
-		while (strcmp(root_dir.root_dir_entries[i].filename, filename) != 0 && i < FS_FILE_MAX_COUNT) //Check each root_dir_entry for filename up til 128
+		if (fs->sb.journal_start + fs->sb.journal_blocks > fs->sb.total_disk_blocks)
 		{
-			i++;
-			// printf("searching through file: %d\n", i);
+			release_fs(fs);
+			return NULL;
 		}
-
-		if (i == fd_table.total_opened - 1)
+		fs->journal = journal_open(fs->disk, fs->sb.journal_start, fs->sb.journal_blocks);
+		if (fs->journal == NULL || disk_read_range(fs->disk, 0, 1, &fs->sb) == -1)
 		{
-			// file not found
-			// printf("file not found\n");
-			return -1;
+			release_fs(fs);
+			return NULL;
 		}
 	}
-	else
-	{
-		/*Find the next available space and open add the entry into the fd_table at offset 0*/
-		/*Note, we shouldn't have to worry about there being no space since we would've returned earlier*/
 
-		while (fd_table.files[j].filename[0] != '\0' && j < FS_OPEN_MAX_COUNT)
-			j++;
-		memcpy(fd_table.files[j].filename, filename, FS_FILENAME_LEN);
-		fd_table.files[j].offset = 0;
-		fd_table.total_opened++;
+	/* The reserved index region is left alone, but must lie within the disk */
+	if (strncmp(fs->sb.index_signature, INDEX_SIGNATURE, 8) == 0
+		&& fs->sb.index_start + fs->sb.index_blocks > fs->sb.total_disk_blocks)
+	{
+		release_fs(fs);
+		return NULL;
 	}
-	return j;
-}
-
-int fs_close(int fd) //gonna assume its 0 based
-{
-	if (!fs_mounted)
-		return -1;
 
-	if(fd > FS_OPEN_MAX_COUNT-1 || fd < 0)
+	/* Every block goes through the cache from now on, except with a mapped disk
+	 * which already lives in memory */
+	if (!use_mmap)
+		fs->cache_blocks = cache_budget_take(cache_blocks);
+	fs->cache = cache_create(fs->disk, fs->cache_blocks);
+	if (fs->cache == NULL)
 	{
-		//invalid fd
-		return -1;
+		release_fs(fs);
+		return NULL;
 	}
-	if(fd_table.files[fd].filename[0] == '\0')
+
+	/* The FAT blocks are immediately followed by the root directory */
+	if (fs->sb.root_dir_index != fs->sb.total_FAT_blocks + 1)
 	{
-		//file not open
-		return -1;
+		release_fs(fs);
+		return NULL;
 	}
-	fd_table.files[fd].filename[0] = '\0';
-	fd_table.files[fd].offset = 0;
-	fd_table.total_opened--;
-	return 0;
-}
 
-int fs_stat(int fd)
-{
-	if (!fs_mounted)
-		return -1;
+	/* Allocate memory for the FAT table and read it from disk */
+	fs->FAT = (uint16_t*)malloc(fs->sb.total_FAT_blocks * BLOCK_SIZE); // allocating memory for FAT
 
-	if(fd > FS_OPEN_MAX_COUNT-1 || fd < 0)
+	if (fs->FAT == NULL)
 	{
-		//invalid fd
-		return -1;
+		// Memory allocation for FAT failed
+		release_fs(fs);
+		return NULL;
 	}
-	if(fd_table.files[fd].filename[0] == '\0')
+
+	/* Read the FAT and the root directory from disk in one request */
+	struct iovec metadata[] = {
+		{ .iov_base = fs->FAT, .iov_len = fs->sb.total_FAT_blocks * BLOCK_SIZE },
+		{ .iov_base = fs->root_dir.root_dir_entries, .iov_len = BLOCK_SIZE },
+	};
+	if (disk_readv(fs->disk, 1, metadata, 2) == -1)
 	{
-		//file not open
-		return -1;
+		release_fs(fs);
+		return NULL;
 	}
 
-	char * filename = (char*)fd_table.files[fd].filename;
-	// printf("FS STAT: filename = %s\n", filename);
-	int current_file_size = -1;
-	int idx = -1;
-	for(int i = 0; i < FS_FILE_MAX_COUNT; i++)
+	if (fs->FAT[0] != FAT_EOC)
 	{
-		if(strcmp((char*)root_dir.root_dir_entries[i].filename, filename) == 0)
-		{
-			current_file_size = root_dir.root_dir_entries[i].size;
-			idx = i;
-			break;
-		}
+		// First entry is not 0xFFFF
+		release_fs(fs);
+		return NULL;
 	}
 
-	if(current_file_size == -1)
-		return -1;
+	if (build_free_map(fs) == -1)
+	{
+		release_fs(fs);
+		return NULL;
+	}
 
-	// int i = 0;
-	// //the file should exist at this point so we don't need to check for missing file
-	// while(strcmp(root_dir.root_dir_entries[i].filename, fd_table.files[fd].filename) == 0)
-	// {
-	// 	printf("root_dir[%d]: %s\n", i, root_dir.root_dir_entries[i].filename);
-	// 	i++;
-	// 	if(i > FS_FILE_MAX_COUNT)
-	// 		return -1;
-	// }
-	
-	// printf("root_dir.root_dir_entries.size[%d]: %d\n", idx, current_file_size);
-	// printf("FS STAT: size = %d\n", root_dir.root_dir_entries[idx].size);
-	return root_dir.root_dir_entries[idx].size;
+	build_dir_hash(fs);
+	return fs;
 }
 
-int fs_lseek(int fd, size_t offset)
+fs_t *fs_mount_h(const char *diskname)
 {
-	/* size_t is supposed to be unsigned, therefore, will never be negative*/
-	// if(offset < 0)
-	// {
-	// 	/*
-	// 	Not asked by Porquet but doesn't make sense to have negative offset
-	// 	*/
-	// 	//invalid offset
-	// 	return -1;
-	// }
-	if(!fs_mounted)
-		return -1;
-	
-	if( fd < 0 || fd >= FS_OPEN_MAX_COUNT || fd_table.files[fd].filename[0] == '\0' )
-		return -1;
-
-	//add other error checks if program doesn't terminate upon error
-	if(offset > (size_t)fs_stat(fd)) //calling fs_stat will run the fd through the error checking in fs_stat
-	{
-		//offset larger than size
-		return -1;
-	}
-	// printf("offset changed to: %zu\n", offset);
-	fd_table.files[fd].offset = offset;
-	// printf("Filename: %s ------> Offset: %ld\n", fd_table.files[fd].filename, offset);
-	return 0;
+	return mount(diskname, 0);
 }
 
-uint16_t get_first_data_block_index(int fd)
+fs_t *fs_mount_mmap_h(const char *diskname)
 {
-	char* filename = fd_table.files[fd].filename;
-	// printf(" $$$$$$$$$$ get_first data filename: %s\n", filename);
-	for( int i = 0; i < FS_FILE_MAX_COUNT; i++)
-	{
-		// printf(" root_dir filename: %s\n", root_dir.root_dir_entries[i].filename);
-		if(strcmp(root_dir.root_dir_entries[i].filename, filename) == 0)
-		{
-			// printf("  get_first_data_block_index filename: %s\n", fd_table.files[fd].filename);
-			// printf("  fd: %d, file: %s, size: %d, data_blk: %d\n", fd, root_dir.root_dir_entries[i].filename, root_dir.root_dir_entries[i].size, root_dir.root_dir_entries[i].first_datablock_index);
-			// printf(" sb.data_block_start_index: [ %d  ]\n", sb.data_block_start_index);
-			return root_dir.root_dir_entries[i].first_datablock_index + sb.data_block_start_index;
-		}
-	}
-	return -1;
+	return mount(diskname, 1);
 }
 
-uint16_t get_last_data_block_index(int fd)
+int fs_mount(const char *diskname)
 {
-	char* filename = fd_table.files[fd].filename;
-	for(int i = 0; i< FS_FILE_MAX_COUNT; i++)
-	{
-		// printf("........comparing: %s | %s at [%d]\n", root_dir.root_dir_entries[i].filename, filename, i);
-		if(strcmp(root_dir.root_dir_entries[i].filename, filename) == 0)
-		{
-			uint16_t index =  root_dir.root_dir_entries[i].first_datablock_index;
-			// printf("index: %d\n", index);
-			uint16_t next = FAT[index];
-			while(next != FAT_EOC)
-			{
-				index = next;
-				next = FAT[index];
-			}
-			return index + sb.data_block_start_index;
-		}
-	}
-	return -1;
+	if (default_fs != NULL)
+		return -1;
+
+	default_fs = mount(diskname, 0);
+	return default_fs != NULL ? 0 : -1;
 }
 
-uint16_t allocate_newblock(int fd)
+int fs_mount_mmap(const char *diskname)
 {
-	uint16_t FAT_idx;
-	/* Iterate through FAT entries to search for free space */
-	/* Skip FAT[0] because it is always FAT_EOC */
-	for (FAT_idx = 1; FAT_idx < sb.data_blocks_count; FAT_idx++)
-	{
-		if(FAT[FAT_idx] == 0)		//found empty and free data block
-		{
-			FAT[FAT_idx] = FAT_EOC;
-			for(int i = 0; i < root_dir.total_opened; i++)
-			{
-				if(strcmp(root_dir.root_dir_entries[i].filename, fd_table.files[fd].filename) == 0)
-				{
-					if(root_dir.root_dir_entries[i].size > 0)
-						FAT[get_last_data_block_index(fd) - sb.data_block_start_index] = FAT_idx;
-					else
-						root_dir.root_dir_entries[i].first_datablock_index = FAT_idx;
-					break;
-				}
-			}
-			return FAT_idx + sb.data_block_start_index;
-		}
-	}
-	return FAT_EOC;	// meaning there is no available space
+	if (default_fs != NULL)
+		return -1;
+
+	default_fs = mount(diskname, 1);
+	return default_fs != NULL ? 0 : -1;
 }
 
-void update_file_size(int fd, size_t bytes_written)
+/* Allocate @count data blocks from @first as a single chain in @FAT */
+static void format_chain(uint16_t *FAT, size_t first, size_t count)
 {
-	char* filename = fd_table.files[fd].filename;
-	for(int i = 0; i < FS_FILE_MAX_COUNT; i++) //total_opened = how many files open != what file is what 
-	{
-		// printf("%d: comparing: %s == %s\n", i, root_dir.root_dir_entries[i].filename, filename);
-		if(strcmp(root_dir.root_dir_entries[i].filename, filename) == 0)
-		{
-			root_dir.root_dir_entries[i].size += bytes_written;
-			// printf("UPDATE FILE SIZE: size = %d\n", root_dir.root_dir_entries[i].size);
-			break;
-		}
-	}
+	for (size_t i = first; i < first + count - 1; i++)
+		FAT[i] = i + 1;
+	FAT[first + count - 1] = FAT_EOC;
 }
 
-int fs_write(int fd, void *buf, size_t count)
+int fs_format(const char *diskname, size_t data_blocks, size_t journal_blocks, size_t index_blocks, int flags)
 {
-	/* TODO: Phase 4 */
-	if(!fs_mounted)
+	if (diskname == NULL || data_blocks == 0)
 		return -1;
-	
-	if(fd < 0 || fd >= fd_table.total_opened)
+
+	/* Every block index must fit in the superblock, and the FAT entries must
+	 * not collide with FAT_EOC */
+	size_t fat_blocks = BLOCKS(data_blocks * sizeof(uint16_t));
+	size_t total_blocks = data_blocks + fat_blocks + 2;
+	if (total_blocks > UINT16_MAX)
 		return -1;
 
-	if(buf == NULL)
+	/* The reserved regions are taken from the data blocks after the first one,
+	 * which is never allocated. A journal must hold every metadata block, as
+	 * with fs_journal_create() */
+	if (journal_blocks > 0 && journal_blocks < fat_blocks + 4)
+		return -1;
+	if (journal_blocks + index_blocks > data_blocks - 1)
 		return -1;
 
-	if(fd_table.files[fd].filename[0] == '\0')
+	/* The superblock, the FAT and the root directory are built in memory, then
+	 * written with a single request: the data blocks already read as zeros */
+	size_t metadata_blocks = fat_blocks + 2;
+	char *metadata = calloc(metadata_blocks, BLOCK_SIZE);
+	if (metadata == NULL)
 		return -1;
 
-	if(count == 0)
-		return 0;
+	struct superblock *sb = (struct superblock *)metadata;
+	memcpy(sb->signature, "ECS150FS", 8);
+	sb->total_disk_blocks = total_blocks;
+	sb->root_dir_index = fat_blocks + 1;
+	sb->data_block_start_index = fat_blocks + 2;
+	sb->data_blocks_count = data_blocks;
+	sb->total_FAT_blocks = fat_blocks;
 
-	struct file f = fd_table.files[fd];
+	uint16_t *FAT = (uint16_t *)(metadata + BLOCK_SIZE);
+	FAT[0] = FAT_EOC;
 
-	// uint16_t block_index = get_first_data_block_index(fd);
-	uint16_t block_index; 
-	if(fs_stat(fd) == 0)
+	size_t next = 1;
+	if (journal_blocks > 0)
 	{
-		// printf("getting new data block\n");
-		block_index = allocate_newblock(fd); //potential problem
+		format_chain(FAT, next, journal_blocks);
+		memcpy(sb->journal_signature, JOURNAL_SIGNATURE, 8);
+		sb->journal_start = sb->data_block_start_index + next;
+		sb->journal_blocks = journal_blocks;
+		next += journal_blocks;
 	}
-	else
+	if (index_blocks > 0)
 	{
-		// printf("getting the last datablock\n");
-		block_index = get_last_data_block_index(fd); //potential problem
+		format_chain(FAT, next, index_blocks);
+		memcpy(sb->index_signature, INDEX_SIGNATURE, 8);
+		sb->index_start = sb->data_block_start_index + next;
+		sb->index_blocks = index_blocks;
 	}
-	//at this point, block_index = the block we're writing to
-	size_t offset_in_block = f.offset % BLOCK_SIZE; //get the last offset in the block -- 0 if newly allocated otherwise 0 or >
+	size_t journal_start = sb->journal_start;
 
-	size_t bytes_written = 0; //we will return this 
-	while(bytes_written < count)
+	struct disk *disk = disk_create(diskname, total_blocks, flags & FS_FORMAT_SPARSE);
+	if (disk == NULL)
 	{
-		void* bounce_buffer = malloc(BLOCK_SIZE);
-
-		/* Read block at @block_nr into @buf */
-		if(block_read(block_index, bounce_buffer) == -1)		// Reading any content at block_index to bounce_buffer
-			return -1;
-		
-		// printf("block_index: %d\n", block_index);
-		// printf("From fs_write: block read to bounce_buffer from %d:\n", block_index);
-		// for (int i = 0; i < 48; i++) {
-		// 	printf("%02x ", ((unsigned char*)bounce_buffer)[i]);
-		// 	if ((i + 1) % 16 == 0) printf("\n"); // print a newline every 16 bytes
-		// }
-		// printf("\n");
-
-		size_t available_space = BLOCK_SIZE - offset_in_block; 
-		if(bytes_written + available_space > count) //if we have a need for this then we did something wrong LMAO
-			available_space = count - bytes_written;
-		
-		memcpy(bounce_buffer + offset_in_block, buf + bytes_written, available_space);
-		// printf("block_index: %d\n", block_index);
-		// printf("offset_in_block: %zu\n", offset_in_block);
-		// printf("bytes_written: %zu\n", bytes_written);
-		// printf("available_space: %zu\n", available_space);
-		// printf("From fs_write: bounce_buffer content:\n");
-		// for (int i = 0; i < 16*2; i++) {
-		// 	printf("%02x ", ((unsigned char*)bounce_buffer)[i]);
-		// 	if ((i + 1) % 16 == 0) printf("\n"); // print a newline every 16 bytes
-		// }
-		// printf("\n");
-
-		/* Write block at @block_nr with @buf's contents */
-		if(block_write(block_index, bounce_buffer) == -1)
-			return -1;
-		/* bytes_written: total bytes written,  available_space: bytes_written in this iteration */
-		size_t remaining_bytes = count - bytes_written - available_space; 
-		// printf("remaining_bytes: %zu\n", remaining_bytes);
-		if(remaining_bytes > 0)			//If we have to write more bytes
-		{
-			uint16_t next_block_index = allocate_newblock(fd);
-			FAT[block_index] = next_block_index;
-			block_index = next_block_index;
-			offset_in_block = 0;
-		}
-		else
-		{
-			// printf("REMAINING BYTES = 0\n");
-			bytes_written += available_space;
-			update_file_size(fd, bytes_written);
-			// printf("file size: %d\n", fs_stat(fd));
-			break;
-		}
-		bytes_written += available_space; //available_size: bytes written in this iteration
-		// printf("last bytes_written: %zu\n", bytes_written);
+		free(metadata);
+		return -1;
 	}
-	// printf("returned bytes_written: %zu\n", bytes_written);
-	return bytes_written;
+
+	int ret = disk_write_range(disk, 0, metadata_blocks, metadata);
+	free(metadata);
+	if (ret == 0 && journal_blocks > 0)
+		ret = journal_format(disk, journal_start, journal_blocks);
+	if (ret == 0)
+		ret = disk_sync(disk);
+	if (disk_close(disk) == -1)
+		ret = -1;
+	return ret;
 }
 
-int fs_read(int fd, void *buf, size_t count)
+/*
+ * Flush every dirty block from the cache, then write back the metadata blocks
+ * modified since they were last written. File data reaches the disk before the
+ * metadata that references it. With a journal, the metadata blocks are first
+ * committed to it as one transaction, so that they are either all updated or
+ * none is if the writes in place get interrupted. The caller decides when the
+ * writes in place must become durable. Called with dir_lock held for writing
+ * and alloc_lock held.
+ */
+static int sync_locked(struct fs *fs)
 {
-	/* TODO: Phase 4 */
-	if(!fs_mounted)
-		return -1;
-	
-	if(fd < 0 || fd >= fd_table.total_opened)
-		return -1;
-
-	if(buf == NULL)
-		return -1;
+	struct journal_block blocks[UINT8_MAX + 3]; // superblock, FAT, root directory
+	size_t count = 0;
 
-	if(fd_table.files[fd].filename[0] == '\0')
+	if (cache_flush(fs->cache) == -1)
 		return -1;
 
-	// char *filename = fd_table.files[fd].filename;
-	size_t offset = fd_table.files[fd].offset;
-	// printf("OFFSET: %ld\n", offset);
+	if (fs->sb_dirty)
+		blocks[count++] = (struct journal_block){ 0, &fs->sb };
+	for (int i = 0; i < fs->sb.total_FAT_blocks; i++)
+	{
+		if (fs->FAT_dirty[i])
+			blocks[count++] = (struct journal_block){ i + 1, fs->FAT + i * FAT_ENTRIES_PER_BLOCK };
+	}
+	if (fs->root_dir_dirty)
+		blocks[count++] = (struct journal_block){ fs->sb.root_dir_index, fs->root_dir.root_dir_entries };
 
-	int file_size = fs_stat(fd);
+	fs->pending_updates = 0;
+	if (count == 0)
+		return 0;
 
-	int remaining_size = file_size - offset; //remaining bytes across all data blocks
-	int bytes_to_read = 0; 
-	if((int) count < remaining_size)
-		bytes_to_read = count;
-	else
-		bytes_to_read = remaining_size;
-	uint16_t data_block_index = get_first_data_block_index(fd);
-	// printf(">>>>>The reading of data_block_index: %d\n", data_block_index);
-	//offset/BLOCK_SIZE = how many blocks we need to move forward from the initial
-	size_t block_inc = 0;
-	// printf("offset/BLOCK_SIZE: %ld\n", offset/BLOCK_SIZE);
-	while(block_inc < offset/BLOCK_SIZE)
-	{
-		data_block_index = FAT[data_block_index];
-		block_inc++;
-		// printf("Iterating the data_block_index: [%d]\n", data_block_index);
-	}
-	//if the offset is past 4095 -> we would be reading not the first data block
-	int bytes_read = 0; // tracking the amount of bytes read into @buf
-	// printf("%s: @ %ld\n", filename, offset);
-	// printf("count: %ld\n", count);
-	// printf("filesize: %d\n", file_size);
-	// printf("remaining_size: %d\n", remaining_size);
-	// printf("bytes_to_read: %d\n", bytes_to_read);
-	// printf("data_block_index: %d\n", data_block_index);
-	// printf("block_inc: %ld | %ld\n", block_inc, offset/BLOCK_SIZE);
-
-	while(bytes_to_read > 0 && data_block_index != FAT_EOC)
-	{
-		// printf(".....bytes_read: %d\n", bytes_read);
-		void *bounce_buffer = malloc(BLOCK_SIZE);
-
-		if(block_read(data_block_index, bounce_buffer) == -1) 
+	/* The file data and the previous checkpoint must be durable before the
+	 * journal gets overwritten, and the transaction before its checkpoint */
+	if (fs->journal != NULL)
+	{
+		if (disk_sync(fs->disk) == -1
+			|| journal_commit(fs->journal, blocks, count) == -1
+			|| disk_sync(fs->disk) == -1)
 			return -1;
-		// printf("block_read to bounce_buffer at block[%d], offset[%ld]: \n", data_block_index, offset);
-		// for (int i = 0; i < 20; i++) {
-		// 	printf("%02x ", ((unsigned char*)bounce_buffer)[i]);
-		// 	if ((i + 1) % 16 == 0) printf("\n"); // print a newline every 16 bytes
-		// }
-		// printf("\n");
-		int block_offset = offset % BLOCK_SIZE;	//offset goes from [0, size_of_file in bytes] % BLOCK_SIZE -> choosing which data block 
-		int block_bytes_to_read = BLOCK_SIZE - block_offset; // checking if there is more than or less than (bytes_to_read)
-		int copy_size = 0;
-		if(bytes_to_read < block_bytes_to_read) //interesting 
-			copy_size = bytes_to_read;
-		else
-			copy_size = block_bytes_to_read;
-		// printf("copy_size: %d\n", copy_size);
+	}
+
+	/* Metadata is not cached: write it in place, gathering consecutive blocks */
+	struct iovec iov[UINT8_MAX + 3];
+	size_t first = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (i > first && blocks[i].block != blocks[i - 1].block + 1)
+		{
+			if (disk_writev(fs->disk, blocks[first].block, iov + first, i - first) == -1)
+				return -1;
+			first = i;
+		}
+		iov[i].iov_base = (void *)blocks[i].data;
+		iov[i].iov_len = BLOCK_SIZE;
+	}
+	if (disk_writev(fs->disk, blocks[first].block, iov + first, count - first) == -1)
+		return -1;
+
+	fs->sb_dirty = 0;
+	memset(fs->FAT_dirty, 0, sizeof(fs->FAT_dirty));
+	fs->root_dir_dirty = 0;
+	return 0;
+}
+
+/*
+ * Take dir_lock for writing and alloc_lock once no asynchronous request is in
+ * flight: the requests were counted in the metadata when submitted, but their
+ * data blocks may not be written yet. Without @wait, give up rather than wait
+ * for them. Return -1 if the locks were not taken.
+ */
+static int lock_idle(struct fs *fs, int wait)
+{
+	for (;;)
+	{
+		pthread_rwlock_wrlock(&fs->dir_lock);
+		pthread_mutex_lock(&fs->alloc_lock);
+
+		/* Requests are submitted with dir_lock held, so none can start now */
+		pthread_mutex_lock(&fs->async_lock);
+		int idle = fs->async_inflight == 0;
+		pthread_mutex_unlock(&fs->async_lock);
+		if (idle)
+			return 0;
+
+		pthread_mutex_unlock(&fs->alloc_lock);
+		pthread_rwlock_unlock(&fs->dir_lock);
+		if (!wait)
+			return -1;
+
+		pthread_mutex_lock(&fs->async_lock);
+		while (fs->async_inflight > 0)
+			pthread_cond_wait(&fs->async_done, &fs->async_lock);
+		pthread_mutex_unlock(&fs->async_lock);
+	}
+}
+
+static int sync_all(struct fs *fs)
+{
+	lock_idle(fs, 1);
+	int ret = sync_locked(fs);
+	pthread_mutex_unlock(&fs->alloc_lock);
+	pthread_rwlock_unlock(&fs->dir_lock);
+	return ret;
+}
+
+/* Count a metadata update. Called with alloc_lock held. */
+static void metadata_updated(struct fs *fs)
+{
+	fs->pending_updates++;
+}
+
+/*
+ * With a journal, commit the pending metadata updates as a group once there
+ * are enough of them, bounding what a crash can lose. Called without holding
+ * any lock. This is best effort: if it fails, or has to wait for asynchronous
+ * requests, the blocks stay dirty and the next call, fs_sync() or fs_umount()
+ * handles them.
+ */
+static void commit_if_due(struct fs *fs)
+{
+	pthread_mutex_lock(&fs->alloc_lock);
+	int due = fs->journal != NULL && fs->pending_updates >= JOURNAL_GROUP_UPDATES;
+	pthread_mutex_unlock(&fs->alloc_lock);
+
+	if (!due || lock_idle(fs, 0) == -1)
+		return;
+
+	sync_locked(fs);
+	pthread_mutex_unlock(&fs->alloc_lock);
+	pthread_rwlock_unlock(&fs->dir_lock);
+}
+
+static int do_sync(struct fs *fs)
+{
+	TIME_OP(fs, FS_STATS_SYNC);
+	if (fs == NULL)
+		return -1;
+
+	if (sync_all(fs) == -1)
+		return -1;
+	return disk_sync(fs->disk);
+}
+
+int fs_sync_h(fs_t *fs)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_sync(fs);
+	trace_call(fs, start, FS_STATS_SYNC, ret, -1, 0, 0, NULL);
+	return ret;
+}
+
+int fs_sync_config(unsigned int max_latency_ms)
+{
+	sync_latency_ms = max_latency_ms;
+	return 0;
+}
+
+/*
+ * Unmount @fs. Return -1 if it is still mounted. Otherwise, @fs is released and
+ * @ret tells whether it was cleanly closed.
+ */
+static int umount(struct fs *fs, int *ret)
+{
+	pthread_rwlock_wrlock(&fs->dir_lock);
+	pthread_mutex_lock(&fs->alloc_lock);
+
+	if(fs->fd_table.total_opened > 0)
+	{
+		//still open fd
+		pthread_mutex_unlock(&fs->alloc_lock);
+		pthread_rwlock_unlock(&fs->dir_lock);
+		return -1;
+	}
+
+	/* Write back everything before letting go of the disk */
+	if (sync_locked(fs) == -1 || disk_sync(fs->disk) == -1)
+	{
+		pthread_mutex_unlock(&fs->alloc_lock);
+		pthread_rwlock_unlock(&fs->dir_lock);
+		return -1;
+	}
+
+	/* Nothing is left to replay */
+	*ret = 0;
+	if (fs->journal != NULL)
+	{
+		*ret = journal_close(fs->journal, 1);
+		fs->journal = NULL;
+	}
+
+	if (disk_close(fs->disk) == -1)
+		*ret = -1;
+	fs->disk = NULL;
+
+	pthread_mutex_unlock(&fs->alloc_lock);
+	pthread_rwlock_unlock(&fs->dir_lock);
+	release_fs(fs);
+	return 0;
+}
+
+int fs_umount_h(fs_t *fs)
+{
+	int ret;
+
+	if (fs == NULL)
+		return -1;
+
+	if (umount(fs, &ret) == -1)
+		return -1;
+	return ret;
+}
+
+int fs_umount(void)
+{
+	int ret;
+
+	/* checking if the file system is mounted*/
+	if (default_fs == NULL)
+		return -1;
+
+	if (umount(default_fs, &ret) == -1)
+		return -1;
+	default_fs = NULL;
+	return ret;
+}
+
+int fs_cache_config(size_t nr_blocks)
+{
+	if (default_fs != NULL)
+	{
+		// cache is in use
+		return -1;
+	}
+
+	cache_blocks = nr_blocks;
+	return 0;
+}
+
+int fs_cache_budget(size_t nr_blocks)
+{
+	pthread_mutex_lock(&cache_budget_lock);
+	cache_budget = nr_blocks;
+	pthread_mutex_unlock(&cache_budget_lock);
+	return 0;
+}
+
+int fs_async_config(unsigned int depth, int use_threads)
+{
+	if (default_fs != NULL)
+	{
+		// engine may be in use
+		return -1;
+	}
+
+	async_depth = depth ? depth : 1;
+	async_flags = use_threads ? AIO_THREADS : 0;
+	return 0;
+}
+
+int fs_cache_flush_h(fs_t *fs)
+{
+	if (fs == NULL)
+		return -1;
+
+	return cache_flush(fs->cache);
+}
+
+int fs_cache_stats_h(fs_t *fs, struct fs_cache_stats *stats)
+{
+	if (fs == NULL || stats == NULL)
+		return -1;
+
+	struct cache_stats cs;
+	cache_get_stats(fs->cache, &cs);
+	stats->hits = cs.hits;
+	stats->misses = cs.misses;
+	stats->evictions = cs.evictions;
+	stats->writebacks = cs.writebacks;
+	return 0;
+}
+
+int fs_stats_h(fs_t *fs, struct fs_stats *stats)
+{
+	if (fs == NULL || stats == NULL)
+		return -1;
+
+	memset(stats, 0, sizeof(struct fs_stats));
+#ifdef FS_STATS
+	stats->enabled = 1;
+#endif
+
+	struct disk_stats ds;
+	disk_get_stats(fs->disk, &ds);
+	stats->block_reads = ds.reads;
+	stats->block_writes = ds.writes;
+	stats->bytes_read = ds.bytes_read;
+	stats->bytes_written = ds.bytes_written;
+	stats->bounce_copies = stats_read(fs->stats.bounce_copies) + ds.bounce_copies;
+	stats->bounce_bytes = stats_read(fs->stats.bounce_bytes) + ds.bounce_bytes;
+	stats->fat_hops = stats_read(fs->stats.fat_hops);
+	stats->dir_lookups = stats_read(fs->stats.dir_lookups);
+	stats->allocations = stats_read(fs->stats.allocations);
+	stats->blocks_allocated = stats_read(fs->stats.blocks_allocated);
+
+	for (int op = 0; op < FS_STATS_OPS; op++)
+	{
+		struct stats_histogram *hist = &fs->stats.ops[op];
+		stats->ops[op].calls = stats_read(hist->count);
+		stats->ops[op].total_ns = stats_read(hist->total_ns);
+		for (int i = 0; i < FS_STATS_BUCKETS; i++)
+			stats->ops[op].buckets[i] = stats_read(hist->buckets[i]);
+	}
+	return 0;
+}
+
+int fs_trace_start_h(fs_t *fs, const char *filename)
+{
+	if (fs == NULL)
+		return -1;
+
+	struct fs_trace_header header = { .version = FS_TRACE_VERSION };
+	memcpy(header.signature, FS_TRACE_SIGNATURE, 8);
+
+	pthread_mutex_lock(&fs->trace_lock);
+	if (fs->trace != NULL)
+	{
+		// already recording
+		pthread_mutex_unlock(&fs->trace_lock);
+		return -1;
+	}
+
+	struct trace *trace = trace_open(filename, &header, sizeof(header));
+	if (trace != NULL)
+	{
+		fs->trace_start = stats_clock();
+		__atomic_store_n(&fs->trace, trace, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&fs->trace_lock);
+	return trace == NULL ? -1 : 0;
+}
+
+int fs_trace_stop_h(fs_t *fs)
+{
+	if (fs == NULL)
+		return -1;
+
+	pthread_mutex_lock(&fs->trace_lock);
+	struct trace *trace = fs->trace;
+	__atomic_store_n(&fs->trace, NULL, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&fs->trace_lock);
+
+	if (trace == NULL)
+		return -1;
+	return trace_close(trace);
+}
+
+int fs_info_h(fs_t *fs)
+{
+	if(fs == NULL)
+	{
+		//no disk mounted
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&fs->dir_lock);
+	pthread_mutex_lock(&fs->alloc_lock);
+
+	printf("FS Info:\n"
+		   "total_blk_count=%d\n"
+		   "fat_blk_count=%d\n"
+		   "rdir_blk=%d\n"
+		   "data_blk=%d\n"
+		   "data_blk_count=%d\n",
+		   fs->sb.total_disk_blocks, fs->sb.total_FAT_blocks, fs->sb.root_dir_index, fs->sb.data_block_start_index, fs->sb.data_blocks_count);
+	printf("fat_free_ratio=%zu/%d\n", fs->free_blocks, fs->sb.data_blocks_count);
+	int root_free = 0;
+	for (int i = 0; i < FS_FILE_MAX_COUNT; i++)
+	{
+		if (fs->root_dir.root_dir_entries[i].filename[0] == '\0')
+			root_free++;
+	}
+	printf("rdir_free_ratio=%d/%d\n", root_free, FS_FILE_MAX_COUNT);
+	if (fs->journal != NULL)
+		printf("journal_blk=%d\njournal_blk_count=%d\n", fs->sb.journal_start, fs->sb.journal_blocks);
+	if (strncmp(fs->sb.index_signature, INDEX_SIGNATURE, 8) == 0)
+		printf("index_blk=%d\nindex_blk_count=%d\n", fs->sb.index_start, fs->sb.index_blocks);
+
+	pthread_mutex_unlock(&fs->alloc_lock);
+	pthread_rwlock_unlock(&fs->dir_lock);
+	return 0;
+}
+
+/* Check that @filename is a valid, NULL-terminated file name */
+static int valid_filename(const char *filename)
+{
+	if (filename == NULL)
+		return 0;
+
+	size_t len = strnlen(filename, FS_FILENAME_LEN);
+	return len > 0 && len < FS_FILENAME_LEN;
+}
+
+static int do_create(struct fs *fs, const char *filename)
+{
+	TIME_OP(fs, FS_STATS_CREATE);
+	/* check if FS is mounted */
+	if (fs == NULL)
+		return -1;
+
+	if (!valid_filename(filename))
+	{
+		// no filename provided, or filename too long
+		return -1;
+	}
+
+	pthread_rwlock_wrlock(&fs->dir_lock);
+
+	if(fs->root_dir.total_opened == FS_FILE_MAX_COUNT)
+	{
+		//max files created
+		pthread_rwlock_unlock(&fs->dir_lock);
+		return -1;
+	}
+
+	if (dir_lookup(fs, filename) != -1)
+	{
+		// file already exists within directory
+		pthread_rwlock_unlock(&fs->dir_lock);
+		return -1;
+	}
+
+	int freeEntry = -1; // keep track of the first freeEntry in the directory
+	for (int i = 0; i < FS_FILE_MAX_COUNT; i++)
+	{
+		if (fs->root_dir.root_dir_entries[i].filename[0] == '\0')
+		{
+			freeEntry = i;
+			break;
+		}
+	}
+	if (freeEntry < 0)
+	{
+		// directory is full
+		pthread_rwlock_unlock(&fs->dir_lock);
+		return -1;
+	}
+
+	struct root_dir_entry *entry = &fs->root_dir.root_dir_entries[freeEntry];
+	memset(entry->filename, 0, FS_FILENAME_LEN);
+	strcpy(entry->filename, filename);
+	entry->size = 0;
+	entry->first_datablock_index = FAT_EOC;
+	fs->root_dir_dirty = 1;
+	dir_hash_insert(fs, freeEntry);
+	fs->root_dir.total_opened++;
+	pthread_mutex_lock(&fs->alloc_lock);
+	metadata_updated(fs);
+	pthread_mutex_unlock(&fs->alloc_lock);
+
+	pthread_rwlock_unlock(&fs->dir_lock);
+	commit_if_due(fs);
+	return 0;
+}
+
+int fs_create_h(fs_t *fs, const char *filename)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_create(fs, filename);
+	trace_call(fs, start, FS_STATS_CREATE, ret, -1, 0, 0, filename);
+	return ret;
+}
+
+static int do_delete(struct fs *fs, const char *filename)
+{
+	TIME_OP(fs, FS_STATS_DELETE);
+	if (fs == NULL)
+		return -1;
+
+	if (!valid_filename(filename))
+	{
+		// provided invalid file name
+		return -1;
+	}
+
+	pthread_rwlock_wrlock(&fs->dir_lock);
+
+	int i = dir_lookup(fs, filename);
+	if (i == -1)
+	{
+		// File not found
+		pthread_rwlock_unlock(&fs->dir_lock);
+		return -1;
+	}
+	struct root_dir_entry *entry = &fs->root_dir.root_dir_entries[i];
+
+	/* Freeing the chain of an open file would leave its fd cursors dangling */
+	pthread_mutex_lock(&fs->fd_lock);
+	for (int fd = 0; fd < FS_OPEN_MAX_COUNT; fd++)
+	{
+		if (fs->fd_table.files[fd].entry == entry)
+		{
+			// file is currently open
+			pthread_mutex_unlock(&fs->fd_lock);
+			pthread_rwlock_unlock(&fs->dir_lock);
+			return -1;
+		}
+	}
+	pthread_mutex_unlock(&fs->fd_lock);
+
+	dir_hash_remove(fs, i);
+	uint16_t index = entry->first_datablock_index;
+	entry->filename[0] = '\0';
+	entry->size = 0;
+	entry->first_datablock_index = FAT_EOC;
+	fs->root_dir_dirty = 1;
+
+	// clear FAT chain
+	pthread_mutex_lock(&fs->alloc_lock);
+	while (index != FAT_EOC)
+	{
+		uint16_t next = fat_next(fs, index);
+		free_data_block(fs, index);
+		index = next;
+	}
+	metadata_updated(fs);
+	pthread_mutex_unlock(&fs->alloc_lock);
+	fs->root_dir.total_opened--;
+
+	pthread_rwlock_unlock(&fs->dir_lock);
+	commit_if_due(fs);
+	return 0;
+}
+
+int fs_delete_h(fs_t *fs, const char *filename)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_delete(fs, filename);
+	trace_call(fs, start, FS_STATS_DELETE, ret, -1, 0, 0, filename);
+	return ret;
+}
+
+int fs_ls_h(fs_t *fs)
+{
+	if (fs == NULL)
+	{
+		// not mounted
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&fs->dir_lock);
+	printf("FS ls:\n");
+	for (int i = 0; i < FS_FILE_MAX_COUNT; i++)
+	{
+		if (fs->root_dir.root_dir_entries[i].filename[0] != '\0')
+			printf("file: %s, size: %d, data_blk: %d\n", fs->root_dir.root_dir_entries[i].filename, fs->root_dir.root_dir_entries[i].size, fs->root_dir.root_dir_entries[i].first_datablock_index);
+	}
+	pthread_rwlock_unlock(&fs->dir_lock);
+	return 0;
+}
+
+static int do_open(struct fs *fs, const char *filename)
+{
+	TIME_OP(fs, FS_STATS_OPEN);
+	if (fs == NULL)
+		return -1;
+
+	if (!valid_filename(filename))
+	{
+		//invalid filename
+		return -1; 
+	}
+
+	pthread_rwlock_rdlock(&fs->dir_lock);
+	pthread_mutex_lock(&fs->fd_lock);
+
+	/* check if there is room to open another file */
+	if (fs->fd_table.total_opened == FS_OPEN_MAX_COUNT)
+	{
+		// max files opened
+		pthread_mutex_unlock(&fs->fd_lock);
+		pthread_rwlock_unlock(&fs->dir_lock);
+		return -1;
+	}
+
+	/*Find whether the file exists*/
+	int i = dir_lookup(fs, filename);
+	if (i == -1)
+	{
+		// file not found
+		pthread_mutex_unlock(&fs->fd_lock);
+		pthread_rwlock_unlock(&fs->dir_lock);
+		return -1;
+	}
+
+	/*Find the next available space and add the entry into the fd_table at offset 0*/
+	/*Note, we shouldn't have to worry about there being no space since we would've returned earlier*/
+	int j = 0;
+	while (fs->fd_table.files[j].entry != NULL)
+		j++;
+
+	memset(&fs->fd_table.files[j], 0, sizeof(struct file));
+	fs->fd_table.files[j].entry = &fs->root_dir.root_dir_entries[i];
+	fs->fd_table.files[j].offset = 0;
+	fs->fd_table.files[j].cursor_block = FAT_EOC;
+	fs->fd_table.total_opened++;
+
+	pthread_mutex_unlock(&fs->fd_lock);
+	pthread_rwlock_unlock(&fs->dir_lock);
+	return j;
+}
+
+int fs_open_h(fs_t *fs, const char *filename)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_open(fs, filename);
+	trace_call(fs, start, FS_STATS_OPEN, ret, -1, 0, 0, filename);
+	return ret;
+}
+
+/* Return the open file referenced by @fd, or NULL if @fd is invalid */
+static struct file *get_file(struct fs *fs, int fd)
+{
+	if (fs == NULL)
+		return NULL;
+
+	if (fd < 0 || fd >= FS_OPEN_MAX_COUNT)
+	{
+		//invalid fd
+		return NULL;
+	}
+	pthread_mutex_lock(&fs->fd_lock);
+	struct root_dir_entry *entry = fs->fd_table.files[fd].entry;
+	pthread_mutex_unlock(&fs->fd_lock);
+	if (entry == NULL)
+	{
+		//file not open
+		return NULL;
+	}
+	return &fs->fd_table.files[fd];
+}
+
+static pthread_rwlock_t *file_lock(struct fs *fs, struct root_dir_entry *entry)
+{
+	return &fs->file_locks[entry - fs->root_dir.root_dir_entries];
+}
+
+/*
+ * Return the open file referenced by @fd with the root directory read-locked
+ * and the file locked, for reading only if @shared, or NULL if @fd is invalid.
+ * Released by unlock_file().
+ */
+static struct file *lock_file_mode(struct fs *fs, int fd, int shared)
+{
+	if (fs == NULL)
+		return NULL;
+
+	pthread_rwlock_rdlock(&fs->dir_lock);
+	struct file *f = get_file(fs, fd);
+	if (f == NULL)
+	{
+		pthread_rwlock_unlock(&fs->dir_lock);
+		return NULL;
+	}
+
+	struct root_dir_entry *entry = f->entry;
+	if (shared)
+		pthread_rwlock_rdlock(file_lock(fs, entry));
+	else
+		pthread_rwlock_wrlock(file_lock(fs, entry));
+	if (f->entry != entry)
+	{
+		// closed meanwhile
+		pthread_rwlock_unlock(file_lock(fs, entry));
+		pthread_rwlock_unlock(&fs->dir_lock);
+		return NULL;
+	}
+	return f;
+}
+
+static struct file *lock_file(struct fs *fs, int fd)
+{
+	return lock_file_mode(fs, fd, 0);
+}
+
+static void unlock_file(struct fs *fs, struct file *f)
+{
+	pthread_rwlock_unlock(file_lock(fs, f->entry));
+	pthread_rwlock_unlock(&fs->dir_lock);
+}
+
+/* Wait for the asynchronous requests in flight on open file @f */
+static void wait_async(struct fs *fs, struct file *f)
+{
+	pthread_mutex_lock(&fs->async_lock);
+	while (f->async_inflight > 0)
+		pthread_cond_wait(&fs->async_done, &fs->async_lock);
+	pthread_mutex_unlock(&fs->async_lock);
+}
+
+static int do_close(struct fs *fs, int fd)
+{
+	TIME_OP(fs, FS_STATS_CLOSE);
+	struct file *f = lock_file(fs, fd);
+	if (f == NULL)
+		return -1;
+
+	/* Mapped blocks must not be reused by another file */
+	if (f->maps > 0)
+	{
+		unlock_file(fs, f);
+		return -1;
+	}
+
+	/* The requests still reference the fd, and may write to the file */
+	wait_async(fs, f);
+
+	pthread_rwlock_t *lock = file_lock(fs, f->entry);
+	free(f->block_map);
+	pthread_mutex_lock(&fs->fd_lock);
+	memset(f, 0, sizeof(struct file));
+	f->cursor_block = FAT_EOC;
+	fs->fd_table.total_opened--;
+	pthread_mutex_unlock(&fs->fd_lock);
+
+	pthread_rwlock_unlock(lock);
+	pthread_rwlock_unlock(&fs->dir_lock);
+	return 0;
+}
+
+int fs_close_h(fs_t *fs, int fd)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_close(fs, fd);
+	trace_call(fs, start, FS_STATS_CLOSE, ret, fd, 0, 0, NULL);
+	return ret;
+}
+
+static int do_fsync(struct fs *fs, int fd)
+{
+	TIME_OP(fs, FS_STATS_FSYNC);
+	struct file *f = get_file(fs, fd);
+	if (f == NULL)
+		return -1;
+
+	/* Data written asynchronously counts once it reaches the disk */
+	wait_async(fs, f);
+
+	/* Only the blocks modified since the last sync are written */
+	if (sync_all(fs) == -1)
+		return -1;
+
+	/* Let concurrent and closely following requests share the same sync */
+	if (sync_latency_ms)
+		return disk_sync_deferred(fs->disk, sync_latency_ms);
+	return disk_sync(fs->disk);
+}
+
+int fs_fsync_h(fs_t *fs, int fd)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_fsync(fs, fd);
+	trace_call(fs, start, FS_STATS_FSYNC, ret, fd, 0, 0, NULL);
+	return ret;
+}
+
+static int do_stat(struct fs *fs, int fd)
+{
+	TIME_OP(fs, FS_STATS_STAT);
+	struct file *f = lock_file(fs, fd);
+	if (f == NULL)
+		return -1;
+
+	int size = f->entry->size;
+	unlock_file(fs, f);
+	return size;
+}
+
+int fs_stat_h(fs_t *fs, int fd)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_stat(fs, fd);
+	trace_call(fs, start, FS_STATS_STAT, ret, fd, 0, 0, NULL);
+	return ret;
+}
+
+static int do_lseek(struct fs *fs, int fd, size_t offset)
+{
+	TIME_OP(fs, FS_STATS_LSEEK);
+	struct file *f = lock_file(fs, fd);
+	if (f == NULL)
+		return -1;
+
+	if (offset > f->entry->size)
+	{
+		//offset larger than size
+		unlock_file(fs, f);
+		return -1;
+	}
+
+	f->offset = offset;
+	if (offset / BLOCK_SIZE < f->cursor_index)
+	{
+		// the cursor can only move forward
+		f->cursor_block = FAT_EOC;
+	}
+	unlock_file(fs, f);
+	return 0;
+}
+
+int fs_lseek_h(fs_t *fs, int fd, size_t offset)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_lseek(fs, fd, offset);
+	trace_call(fs, start, FS_STATS_LSEEK, ret, fd, 0, offset, NULL);
+	return ret;
+}
+
+/* Allocate a data block, FAT_EOC if the disk is full. Called with alloc_lock held. */
+static uint16_t allocate_newblock(struct fs *fs)
+{
+	if (fs->free_blocks == 0)
+		return FAT_EOC;	// meaning there is no available space
+
+	/* Scan the bitmap a word at a time from the cursor, wrapping around once */
+	size_t word = fs->alloc_cursor / 64;
+	uint64_t bits = fs->free_map[word] & (~0ULL << (fs->alloc_cursor % 64));
+	for (size_t n = 0; n <= fs->free_map_words; n++)
+	{
+		if (bits != 0)
+		{
+			uint16_t FAT_idx = word * 64 + __builtin_ctzll(bits);
+			fs->free_map[word] &= ~(1ULL << (FAT_idx % 64));
+			fs->free_blocks--;
+			set_FAT(fs, FAT_idx, FAT_EOC);
+			fs->alloc_cursor = FAT_idx + 1 < fs->sb.data_blocks_count ? FAT_idx + 1 : 0;
+			return FAT_idx;
+		}
+		word = (word + 1) % fs->free_map_words;
+		bits = fs->free_map[word];
+	}
+	return FAT_EOC;
+}
+
+/*
+ * Return the index of the first FAT entry at or after @i whose free bit equals
+ * @value, or data_blocks_count if there is none.
+ */
+static size_t find_free_bit(struct fs *fs, size_t i, int value)
+{
+	while (i < fs->sb.data_blocks_count)
+	{
+		uint64_t bits = value ? fs->free_map[i / 64] : ~fs->free_map[i / 64];
+		bits &= ~0ULL << (i % 64);
+		if (bits != 0)
+		{
+			i = (i & ~(size_t)63) + __builtin_ctzll(bits);
+			break;
+		}
+		i = (i & ~(size_t)63) + 64;
+	}
+	return i < fs->sb.data_blocks_count ? i : fs->sb.data_blocks_count;
+}
+
+/*
+ * Allocate up to @want physically contiguous data blocks and chain them
+ * together. The smallest free extent holding @want blocks is used, or the
+ * largest one if none is big enough. Return the first block and set @got to the
+ * number of blocks allocated, or return FAT_EOC if the disk is full. Called with
+ * alloc_lock held.
+ */
+static uint16_t allocate_extent(struct fs *fs, size_t want, size_t *got)
+{
+	stats_add(fs->stats.allocations, 1);
+	*got = 0;
+	if (want <= 1 || fs->free_blocks == 0)
+	{
+		uint16_t block = allocate_newblock(fs);
+		if (block != FAT_EOC)
+			*got = 1;
+		stats_add(fs->stats.blocks_allocated, *got);
+		return block;
+	}
+
+	size_t best = 0, best_len = 0;
+	size_t start = find_free_bit(fs, 0, 1);
+	while (start < fs->sb.data_blocks_count)
+	{
+		size_t end = find_free_bit(fs, start, 0);
+		size_t len = end - start;
+		if (len >= want ? (best_len < want || len < best_len) : len > best_len)
+		{
+			best = start;
+			best_len = len;
+			if (len == want)
+				break;	// exact fit
+		}
+		start = find_free_bit(fs, end, 1);
+	}
+
+	if (best_len > want)
+		best_len = want;
+
+	for (size_t i = best; i < best + best_len; i++)
+	{
+		fs->free_map[i / 64] &= ~(1ULL << (i % 64));
+		set_FAT(fs, i, i + 1 < best + best_len ? i + 1 : FAT_EOC);
+	}
+	fs->free_blocks -= best_len;
+	*got = best_len;
+	stats_add(fs->stats.blocks_allocated, best_len);
+	return best;
+}
+
+/*
+ * Return the data block following @index in its chain. If @index is the last
+ * one, extend the chain with an extent of up to @want newly allocated blocks.
+ * FAT_EOC if the disk is full.
+ */
+static uint16_t next_data_block(struct fs *fs, uint16_t index, size_t want)
+{
+	/* Only the owner of the chain extends it, so its end can be checked without locking */
+	uint16_t next = fat_next(fs, index);
+	if (next != FAT_EOC)
+		return next;
+
+	pthread_mutex_lock(&fs->alloc_lock);
+	size_t got;
+	next = allocate_extent(fs, want, &got);
+	if (next != FAT_EOC)
+		set_FAT(fs, index, next);
+	pthread_mutex_unlock(&fs->alloc_lock);
+	return next;
+}
+
+/*
+ * Record @block as the data block following the ones in the block map of @f.
+ * The map is only an accelerator, so it simply stops growing if memory runs
+ * out.
+ */
+static void block_map_append(struct file *f, uint16_t block)
+{
+	if (f->block_map_len == f->block_map_size)
+	{
+		size_t size = f->block_map_size ? 2 * f->block_map_size : 64;
+		uint16_t *map = realloc(f->block_map, size * sizeof(uint16_t));
+		if (map == NULL)
+			return;
+		f->block_map = map;
+		f->block_map_size = size;
+	}
+	f->block_map[f->block_map_len++] = block;
+}
+
+/*
+ * Return the data block at position @index in the chain of open file @f.
+ * Sequential accesses walk the chain from the fd's cursor. The first time
+ * the chain has to be walked from its head to reach a later position, a block
+ * map of the chain is built along the way; from then on, positions it covers
+ * are found directly, and the others extend it. When @want is not 0, the chain
+ * is extended with extents of up to @want blocks if it is too short. FAT_EOC
+ * if the chain is too short (or the disk is full).
+ */
+static uint16_t get_data_block(struct fs *fs, struct file *f, size_t index, size_t want)
+{
+	struct root_dir_entry *entry = f->entry;
+	uint16_t block;
+	size_t i;
+
+	if (f->block_map_len > index)
+		return f->block_map[index];
+
+	if (f->block_map_len > 0)
+	{
+		/* Start from the end of the block map, or from the cursor if it is further */
+		i = f->block_map_len - 1;
+		block = f->block_map[i];
+		if (f->cursor_block != FAT_EOC && f->cursor_index > i && f->cursor_index <= index)
+		{
+			block = f->cursor_block;
+			i = f->cursor_index;
+		}
+	}
+	else if (f->cursor_block != FAT_EOC && f->cursor_index <= index)
+	{
+		block = f->cursor_block;
+		i = f->cursor_index;
+	}
+	else
+	{
+		/* An empty file gets its first data blocks on its first write */
+		block = entry->first_datablock_index;
+		if (block == FAT_EOC && want)
+		{
+			pthread_mutex_lock(&fs->alloc_lock);
+			size_t got;
+			block = allocate_extent(fs, want, &got);
+			entry->first_datablock_index = block;
+			fs->root_dir_dirty = 1;
+			pthread_mutex_unlock(&fs->alloc_lock);
+		}
+		i = 0;
+
+		/* Not a sequential access: index the chain while walking it */
+		if (index > 0 && block != FAT_EOC)
+			block_map_append(f, block);
+	}
+
+	for (; i < index && block != FAT_EOC; i++)
+	{
+		block = want ? next_data_block(fs, block, want) : fat_next(fs, block);
+		if (f->block_map_len == i + 1 && block != FAT_EOC)
+			block_map_append(f, block);
+	}
+	return block;
+}
+
+/*
+ * Same as get_data_block() without extending the chain, for accesses which
+ * must leave open file @f alone (e.g., positional reads, which run in
+ * parallel): the block map and the cursor are used, but not updated.
+ */
+static uint16_t find_data_block(struct fs *fs, const struct file *f, size_t index)
+{
+	if (f->block_map_len > index)
+		return f->block_map[index];
+
+	uint16_t block = f->entry->first_datablock_index;
+	size_t i = 0;
+	if (f->block_map_len > 0)
+	{
+		i = f->block_map_len - 1;
+		block = f->block_map[i];
+	}
+	if (f->cursor_block != FAT_EOC && f->cursor_index >= i && f->cursor_index <= index)
+	{
+		block = f->cursor_block;
+		i = f->cursor_index;
+	}
+
+	for (; i < index && block != FAT_EOC; i++)
+		block = fat_next(fs, block);
+	return block;
+}
+
+static int do_reserve(struct fs *fs, int fd, size_t bytes)
+{
+	TIME_OP(fs, FS_STATS_RESERVE);
+	struct file *f = lock_file(fs, fd);
+	if (f == NULL)
+		return -1;
+
+	struct root_dir_entry *entry = f->entry;
+
+	/* Count the blocks already in the chain */
+	size_t have = 0;
+	uint16_t last = FAT_EOC;
+	for (uint16_t block = entry->first_datablock_index; block != FAT_EOC; block = fat_next(fs, block))
+	{
+		last = block;
+		have++;
+	}
+
+	if (BLOCKS(bytes) <= have)
+	{
+		unlock_file(fs, f);
+		return 0;
+	}
+
+	pthread_mutex_lock(&fs->alloc_lock);
+
+	size_t want = BLOCKS(bytes) - have;
+	if (want > fs->free_blocks)
+	{
+		// not enough space on disk
+		pthread_mutex_unlock(&fs->alloc_lock);
+		unlock_file(fs, f);
+		return -1;
+	}
+
+	/* Append as few extents as possible to the chain */
+	while (want > 0)
+	{
+		size_t got;
+		uint16_t first = allocate_extent(fs, want, &got);
+		if (last == FAT_EOC)
+		{
+			entry->first_datablock_index = first;
+			fs->root_dir_dirty = 1;
+		}
+		else
+			set_FAT(fs, last, first);
+		last = first + got - 1;
+		want -= got;
+	}
+	metadata_updated(fs);
+
+	pthread_mutex_unlock(&fs->alloc_lock);
+	unlock_file(fs, f);
+	commit_if_due(fs);
+	return 0;
+}
+
+int fs_reserve_h(fs_t *fs, int fd, size_t bytes)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_reserve(fs, fd, bytes);
+	trace_call(fs, start, FS_STATS_RESERVE, ret, fd, bytes, 0, NULL);
+	return ret;
+}
+
+/* Called with dir_lock held for writing and alloc_lock held */
+static int journal_create(struct fs *fs, size_t nr_blocks)
+{
+	if (fs->journal != NULL)
+	{
+		// file system already has a journal
+		return -1;
+	}
+
+	/* A transaction must hold the superblock, the FAT and the root directory,
+	 * plus its descriptor and commit record */
+	if (nr_blocks < (size_t)fs->sb.total_FAT_blocks + 4 || nr_blocks > fs->free_blocks)
+		return -1;
+
+	/* The journal region is taken from the data blocks, and must be contiguous */
+	size_t got;
+	uint16_t first = allocate_extent(fs, nr_blocks, &got);
+	size_t start = fs->sb.data_block_start_index + first;
+	if (got < nr_blocks || journal_format(fs->disk, start, nr_blocks) == -1
+		|| (fs->journal = journal_open(fs->disk, start, nr_blocks)) == NULL)
+	{
+		for (size_t i = 0; i < got; i++)
+			free_data_block(fs, first + i);
+		return -1;
+	}
+
+	memcpy(fs->sb.journal_signature, JOURNAL_SIGNATURE, 8);
+	fs->sb.journal_start = start;
+	fs->sb.journal_blocks = nr_blocks;
+	fs->sb_dirty = 1;
+
+	/* The first transaction records the journal itself */
+	return sync_locked(fs);
+}
+
+int fs_journal_create_h(fs_t *fs, size_t nr_blocks)
+{
+	if (fs == NULL)
+		return -1;
+
+	lock_idle(fs, 1);
+	int ret = journal_create(fs, nr_blocks);
+	pthread_mutex_unlock(&fs->alloc_lock);
+	pthread_rwlock_unlock(&fs->dir_lock);
+	return ret;
+}
+
+/*
+ * Copy @len bytes at @offset_in_block of data block @block into @buf. A mapped
+ * disk is read in place, otherwise the bytes come straight from the cached
+ * block.
+ */
+static int read_partial_block(struct fs *fs, uint16_t block, size_t offset_in_block, void *buf, size_t len)
+{
+	char *mapped = disk_map(fs->disk, fs->sb.data_block_start_index + block);
+	if (mapped != NULL)
+	{
+		memcpy(buf, mapped + offset_in_block, len);
+		return 0;
+	}
+
+	stats_add(fs->stats.bounce_copies, 1);
+	stats_add(fs->stats.bounce_bytes, len);
+	return cache_read_partial(fs->cache, fs->sb.data_block_start_index + block, offset_in_block, buf, len);
+}
+
+/*
+ * Copy @len bytes of @buf at @offset_in_block of data block @block, keeping the
+ * rest of the block. A mapped disk is written in place, otherwise the bytes go
+ * straight into the cached block. If the block holds no file data yet (@fresh),
+ * its previous content is not read but replaced with zeros.
+ */
+static int write_partial_block(struct fs *fs, uint16_t block, size_t offset_in_block, const void *buf, size_t len, int fresh)
+{
+	char *mapped = disk_map(fs->disk, fs->sb.data_block_start_index + block);
+	if (mapped != NULL)
+	{
+		memcpy(mapped + offset_in_block, buf, len);
+		if (fresh)
+			memset(mapped + offset_in_block + len, 0, BLOCK_SIZE - offset_in_block - len);
+		return 0;
+	}
+
+	stats_add(fs->stats.bounce_copies, 1);
+	stats_add(fs->stats.bounce_bytes, len);
+
+	/* Nothing before the end of the file can be in the block, so @offset_in_block is 0 */
+	if (fresh)
+		return cache_write_new(fs->cache, fs->sb.data_block_start_index + block, buf, len);
+
+	return cache_write_partial(fs->cache, fs->sb.data_block_start_index + block, offset_in_block, buf, len);
+}
+
+/* Block request completion: the last one completes the asynchronous request */
+static void async_put(struct async_request *req, int failed)
+{
+	struct fs *fs = req->fs;
+
+	pthread_mutex_lock(&fs->async_lock);
+	if (failed)
+		req->failed = 1;
+	int last = --req->pending == 0;
+	pthread_mutex_unlock(&fs->async_lock);
+	if (!last)
+		return;
+
+	/* Still counting the request keeps the file open, and so @fs mounted. The
+	 * metadata it held back is committed by the submitting threads, the
+	 * completions must not wait for the disk */
+	req->callback(req->fd, req->failed ? -1 : req->bytes, req->arg);
+
+	pthread_mutex_lock(&fs->async_lock);
+	req->f->async_inflight--;
+	fs->async_inflight--;
+	pthread_cond_broadcast(&fs->async_done);
+	pthread_mutex_unlock(&fs->async_lock);
+	free(req);
+}
+
+static void async_blocks_done(void *arg, int ret)
+{
+	struct async_blocks *b = arg;
+	struct async_request *req = b->req;
+
+	/* The cached copies were updated as clean before the write */
+	if (ret == -1 && b->write)
+		cache_update(req->fs->cache, b->block, b->count, b->buf, 1);
+
+	free(b);
+	async_put(req, ret == -1);
+}
+
+/* Transfer @count disk blocks starting at @block in the background, for @req */
+static int async_submit(struct fs *fs, struct async_request *req, int write, size_t block, size_t count, void *buf)
+{
+	struct async_blocks *b = malloc(sizeof(struct async_blocks));
+	if (b == NULL)
+		return -1;
+
+	b->req = req;
+	b->write = write;
+	b->block = block;
+	b->count = count;
+	b->buf = buf;
+
+	pthread_mutex_lock(&fs->async_lock);
+	req->pending++;
+	pthread_mutex_unlock(&fs->async_lock);
+
+	if (aio_submit(fs->aio, write, block, count, buf, async_blocks_done, b) == -1)
+	{
+		// still referenced by the submitter, cannot complete here
+		pthread_mutex_lock(&fs->async_lock);
+		req->pending--;
+		pthread_mutex_unlock(&fs->async_lock);
+		free(b);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Read @nblocks consecutive data blocks starting at @block into @buf. For an
+ * asynchronous request @req, cached blocks are copied right away and each run
+ * of uncached blocks is read in the background.
+ */
+static int read_blocks(struct fs *fs, struct async_request *req, uint16_t block, size_t nblocks, void *buf)
+{
+	size_t first = fs->sb.data_block_start_index + block;
+	if (req == NULL)
+		return cache_read_range(fs->cache, first, nblocks, buf);
+
+	size_t run = 0; // uncached blocks before block @i
+	for (size_t i = 0; i <= nblocks; i++)
+	{
+		if (i < nblocks && cache_peek(fs->cache, first + i, (char *)buf + i * BLOCK_SIZE) == -1)
+		{
+			run++;
+			continue;
+		}
+		if (run > 0 && async_submit(fs, req, 0, first + i - run, run, (char *)buf + (i - run) * BLOCK_SIZE) == -1)
+			return -1;
+		run = 0;
+	}
+	return 0;
+}
+
+/*
+ * Write @nblocks consecutive data blocks starting at @block from @buf. For an
+ * asynchronous request @req, the blocks are written in the background, after
+ * updating their cached copies as cache_write_range() does.
+ */
+static int write_blocks(struct fs *fs, struct async_request *req, uint16_t block, size_t nblocks, void *buf)
+{
+	size_t first = fs->sb.data_block_start_index + block;
+	if (req == NULL)
+		return cache_write_range(fs->cache, first, nblocks, buf);
+
+	cache_update(fs->cache, first, nblocks, buf, 0);
+	if (async_submit(fs, req, 1, first, nblocks, buf) == -1)
+	{
+		cache_update(fs->cache, first, nblocks, buf, 1);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Write to open file @f, which is locked, at @offset. The fd offset is left to
+ * the caller. Whole blocks are written in the background for asynchronous
+ * request @req, if not NULL.
+ */
+static int file_write(struct fs *fs, struct file *f, size_t offset, void *buf, size_t count, struct async_request *req)
+{
+	struct root_dir_entry *entry = f->entry;
+
+	/* Move to the data block holding @offset, which may be a new one */
+	uint16_t block = get_data_block(fs, f, offset / BLOCK_SIZE, BLOCKS(count));
+	if (block == FAT_EOC)
+		return 0; // disk is full
+
+	size_t bytes_written = 0;
+	while (bytes_written < count)
+	{
+		size_t offset_in_block = offset % BLOCK_SIZE;
+		size_t remaining = count - bytes_written;
+		uint16_t last = block;		// last data block written in this iteration
+		uint16_t pending = FAT_EOC;	// next data block, if already known
+		size_t chunk;
+
+		if (offset_in_block != 0 || remaining < BLOCK_SIZE)
+		{
+			/* Partial block: merge the new bytes with the current content */
+			chunk = BLOCK_SIZE - offset_in_block;
+			if (chunk > remaining)
+				chunk = remaining;
+
+			/* A block past the end of the file (e.g., just allocated) needs no read-modify-write */
+			int fresh = offset - offset_in_block >= entry->size;
+			if (write_partial_block(fs, block, offset_in_block, (char *)buf + bytes_written, chunk, fresh) == -1)
+				return -1;
+		}
+		else
+		{
+			/* Whole blocks: write as many as are laid out contiguously on disk at once */
+			size_t nblocks = 1;
+			while (nblocks < remaining / BLOCK_SIZE)
+			{
+				uint16_t next = next_data_block(fs, last, BLOCKS(remaining) - nblocks);
+				if (next != last + 1)
+				{
+					pending = next;
+					break;
+				}
+				last = next;
+				nblocks++;
+			}
+
+			if (write_blocks(fs, req, block, nblocks, (char *)buf + bytes_written) == -1)
+				return -1;
+			chunk = nblocks * BLOCK_SIZE;
+		}
+
+		bytes_written += chunk;
+		offset += chunk;
+		f->cursor_block = last;
+		f->cursor_index = (offset - 1) / BLOCK_SIZE;
+		if (bytes_written == count)
+			break;
+
+		block = pending != FAT_EOC ? pending : next_data_block(fs, last, BLOCKS(count - bytes_written));
+		if (block == FAT_EOC)
+			break; // disk is full, write as many bytes as possible
+	}
+
+	/* Writing past the end of the file extends it */
+	if (offset > entry->size)
+	{
+		entry->size = offset;
+		pthread_mutex_lock(&fs->alloc_lock);
+		fs->root_dir_dirty = 1;
+		metadata_updated(fs);
+		pthread_mutex_unlock(&fs->alloc_lock);
+	}
+
+	return bytes_written;
+}
+
+static int do_write(struct fs *fs, int fd, void *buf, size_t count)
+{
+	TIME_OP(fs, FS_STATS_WRITE);
+	if(buf == NULL)
+		return -1;
+
+	struct file *f = lock_file(fs, fd);
+	if (f == NULL)
+		return -1;
+
+	int ret = count == 0 ? 0 : file_write(fs, f, f->offset, buf, count, NULL);
+	if (ret > 0)
+		f->offset += ret;
+	unlock_file(fs, f);
+	commit_if_due(fs);
+	return ret;
+}
+
+int fs_write_h(fs_t *fs, int fd, void *buf, size_t count)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_write(fs, fd, buf, count);
+	trace_call(fs, start, FS_STATS_WRITE, ret, fd, count, 0, NULL);
+	return ret;
+}
+
+/* Prefetch @count consecutive data blocks starting at @block */
+static void prefetch_blocks(struct fs *fs, uint16_t block, size_t count)
+{
+	/* A mapped disk only needs the kernel to page the blocks in */
+	char *mapped = disk_map(fs->disk, fs->sb.data_block_start_index + block);
+	if (mapped != NULL)
+	{
+		madvise(mapped, count * BLOCK_SIZE, MADV_WILLNEED);
+		return;
+	}
+
+	// best effort, a failure shows up when the blocks are actually read
+	cache_prefetch(fs->cache, fs->sb.data_block_start_index + block, count);
+}
+
+/*
+ * Sequential readahead for open file @f, after a read of bytes @start to @end.
+ * A read starting where the previous one ended doubles the window, up to
+ * READAHEAD_MAX blocks or a quarter of the block cache; any other read closes
+ * it. Once the reader gets within half a window of the blocks prefetched so
+ * far, the next window of the chain is loaded, with one request per contiguous
+ * extent, so that small sequential reads find their blocks in memory.
+ */
+static void readahead(struct fs *fs, struct file *f, size_t start, size_t end)
+{
+	size_t max = disk_map(fs->disk, 0) != NULL ? READAHEAD_MAX : fs->cache_blocks / 4;
+	if (max > READAHEAD_MAX)
+		max = READAHEAD_MAX;
+
+	if (start != f->ra_offset || max < READAHEAD_MIN)
+	{
+		f->ra_offset = end;
+		f->ra_window = 0;
+		f->ra_end = 0;
+		return;
+	}
+	f->ra_offset = end;
+	f->ra_window = f->ra_window == 0 ? READAHEAD_MIN : 2 * f->ra_window;
+	if (f->ra_window > max)
+		f->ra_window = max;
+
+	/* Large reads already go to the disk with large requests */
+	if (end - start >= max * BLOCK_SIZE)
+		return;
+
+	size_t next = BLOCKS(end);	// first chain position not read yet
+	size_t last = BLOCKS(f->entry->size);
+	if (f->ra_end < next)
+		f->ra_end = next;
+	if (f->ra_end >= last || f->ra_end - next > f->ra_window / 2)
+		return;
+
+	size_t until = next + f->ra_window < last ? next + f->ra_window : last;
+	size_t pos = f->ra_end;
+	uint16_t block = get_data_block(fs, f, pos, 0);
+	while (pos < until && block != FAT_EOC)
+	{
+		uint16_t first = block;
+		size_t count = 1;
+		while (pos + count < until && fat_next(fs, block) == block + 1)
+		{
+			block++;
+			count++;
+		}
+		prefetch_blocks(fs, first, count);
+		pos += count;
+		block = fat_next(fs, block);
+	}
+	f->ra_end = pos;
+}
+
+/*
+ * Read from open file @f, which is locked, at @offset. The fd offset is left
+ * to the caller. Whole blocks are read in the background for asynchronous
+ * request @req, if not NULL. A @positional read leaves the fd alone (cursor,
+ * block map and readahead), so that it only needs the file locked for reading.
+ */
+static int file_read(struct fs *fs, struct file *f, size_t offset, void *buf, size_t count, struct async_request *req, int positional)
+{
+	struct root_dir_entry *entry = f->entry;
+	size_t start = offset;
+	if (offset >= entry->size)
+		return 0;
+
+	size_t bytes_to_read = entry->size - offset; // remaining bytes across all data blocks
+	if (count < bytes_to_read)
+		bytes_to_read = count;
+
+	uint16_t block = positional ? find_data_block(fs, f, offset / BLOCK_SIZE) : get_data_block(fs, f, offset / BLOCK_SIZE, 0);
+
+	size_t bytes_read = 0; // tracking the amount of bytes read into @buf
+	while (bytes_read < bytes_to_read && block != FAT_EOC)
+	{
+		size_t offset_in_block = offset % BLOCK_SIZE;
+		size_t remaining = bytes_to_read - bytes_read;
+		uint16_t last = block;		// last data block read in this iteration
+		size_t chunk;
+
+		if (offset_in_block != 0 || remaining < BLOCK_SIZE)
+		{
+			/* Partial block */
+			chunk = BLOCK_SIZE - offset_in_block;
+			if (chunk > remaining)
+				chunk = remaining;
+
+			if (read_partial_block(fs, block, offset_in_block, (char *)buf + bytes_read, chunk) == -1)
+				return -1;
+		}
+		else
+		{
+			/* Whole blocks: read the contiguous part of the chain at once */
+			size_t nblocks = 1;
+			while (nblocks < remaining / BLOCK_SIZE && fat_next(fs, last) == last + 1)
+			{
+				last++;
+				nblocks++;
+			}
+
+			if (read_blocks(fs, req, block, nblocks, (char *)buf + bytes_read) == -1)
+				return -1;
+			chunk = nblocks * BLOCK_SIZE;
+		}
+
+		bytes_read += chunk;
+		offset += chunk;
+		if (!positional)
+		{
+			f->cursor_block = last;
+			f->cursor_index = (offset - 1) / BLOCK_SIZE;
+		}
+		block = fat_next(fs, last);	// go to the next data block for current file
+	}
+
+	/* Asynchronous reads are not worth delaying with a prefetch */
+	if (req == NULL && !positional)
+		readahead(fs, f, start, offset);
+
+	return bytes_read;
+}
+
+static int do_read(struct fs *fs, int fd, void *buf, size_t count)
+{
+	TIME_OP(fs, FS_STATS_READ);
+	if(buf == NULL)
+		return -1;
+
+	struct file *f = lock_file(fs, fd);
+	if (f == NULL)
+		return -1;
+
+	int ret = file_read(fs, f, f->offset, buf, count, NULL, 0);
+	if (ret > 0)
+		f->offset += ret;
+	unlock_file(fs, f);
+	return ret;
+}
+
+int fs_read_h(fs_t *fs, int fd, void *buf, size_t count)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_read(fs, fd, buf, count);
+	trace_call(fs, start, FS_STATS_READ, ret, fd, count, 0, NULL);
+	return ret;
+}
+
+static int do_pwrite(struct fs *fs, int fd, void *buf, size_t count, size_t offset)
+{
+	TIME_OP(fs, FS_STATS_PWRITE);
+	if(buf == NULL)
+		return -1;
+
+	struct file *f = lock_file(fs, fd);
+	if (f == NULL)
+		return -1;
+
+	if (offset > f->entry->size)
+	{
+		//offset larger than size
+		unlock_file(fs, f);
+		return -1;
+	}
+
+	int ret = count == 0 ? 0 : file_write(fs, f, offset, buf, count, NULL);
+	unlock_file(fs, f);
+	commit_if_due(fs);
+	return ret;
+}
+
+int fs_pwrite_h(fs_t *fs, int fd, void *buf, size_t count, size_t offset)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_pwrite(fs, fd, buf, count, offset);
+	trace_call(fs, start, FS_STATS_PWRITE, ret, fd, count, offset, NULL);
+	return ret;
+}
+
+static int do_pread(struct fs *fs, int fd, void *buf, size_t count, size_t offset)
+{
+	TIME_OP(fs, FS_STATS_PREAD);
+	if(buf == NULL)
+		return -1;
+
+	/* Positional reads of a file run in parallel */
+	struct file *f = lock_file_mode(fs, fd, 1);
+	if (f == NULL)
+		return -1;
+
+	if (offset > f->entry->size)
+	{
+		//offset larger than size
+		unlock_file(fs, f);
+		return -1;
+	}
+
+	int ret = file_read(fs, f, offset, buf, count, NULL, 1);
+	unlock_file(fs, f);
+	return ret;
+}
+
+int fs_pread_h(fs_t *fs, int fd, void *buf, size_t count, size_t offset)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_pread(fs, fd, buf, count, offset);
+	trace_call(fs, start, FS_STATS_PREAD, ret, fd, count, offset, NULL);
+	return ret;
+}
+
+/*
+ * Whether fs_read_map() hands out private copies: without a cache, or with a
+ * single block of cache, which cannot be pinned since eviction needs it
+ */
+static int map_copies(struct fs *fs)
+{
+	return fs->cache_blocks < 2 && disk_map(fs->disk, 0) == NULL;
+}
+
+static int do_read_map(struct fs *fs, int fd, size_t offset, size_t count, struct iovec **iov, int *iovcnt)
+{
+	TIME_OP(fs, FS_STATS_READ_MAP);
+	if (iov == NULL || iovcnt == NULL)
+		return -1;
+
+	struct file *f = lock_file(fs, fd);
+	if (f == NULL)
+		return -1;
+
+	if (offset > f->entry->size)
+	{
+		//offset larger than size
+		unlock_file(fs, f);
+		return -1;
+	}
+	if (count > f->entry->size - offset)
+		count = f->entry->size - offset;
+
+	size_t index = offset / BLOCK_SIZE;
+	struct iovec *vec = malloc((BLOCKS(offset + count) - index + 1) * sizeof(struct iovec));
+	if (vec == NULL)
+	{
+		unlock_file(fs, f);
+		return -1;
+	}
+
+	int cnt = 0;
+	size_t mapped = 0;
+	if (map_copies(fs))
+	{
+		/* Nothing to point into: fall back to a private copy */
+		void *buf = malloc(count ? count : 1);
+		int ret = buf == NULL ? -1 : file_read(fs, f, offset, buf, count, NULL, 1);
+		if (ret == -1)
+		{
+			free(buf);
+			free(vec);
+			unlock_file(fs, f);
+			return -1;
+		}
+		vec[cnt].iov_base = buf;
+		vec[cnt++].iov_len = ret;
+		mapped = ret;
+	}
+
+	uint16_t block = mapped < count ? get_data_block(fs, f, index, 0) : FAT_EOC;
+	uint16_t prefetch_start = 0, prefetch_end = 0; // data blocks last prefetched
+	while (mapped < count && block != FAT_EOC)
+	{
+		size_t offset_in_block = (offset + mapped) % BLOCK_SIZE;
+		size_t chunk = BLOCK_SIZE - offset_in_block;
+		if (chunk > count - mapped)
+			chunk = count - mapped;
 
-        memcpy(buf + bytes_read, bounce_buffer + block_offset, copy_size);
-		offset += copy_size;
-		bytes_read += copy_size;
-		bytes_to_read -= copy_size;
+		char *data = disk_map(fs->disk, fs->sb.data_block_start_index + block);
+		if (data == NULL)
+		{
+			/* Load each extent with a single request before pinning its blocks */
+			if (block < prefetch_start || block >= prefetch_end)
+			{
+				size_t n = 1;
+				while (n < fs->cache_blocks / 4 && n < BLOCKS(count - mapped + offset_in_block) && fat_next(fs, block + n - 1) == block + n)
+					n++;
+				cache_prefetch(fs->cache, fs->sb.data_block_start_index + block, n);
+				prefetch_start = block;
+				prefetch_end = block + n;
+			}
+			data = cache_pin(fs->cache, fs->sb.data_block_start_index + block);
+			if (data == NULL)
+				break; // too many pinned blocks, map what could be
+		}
+		data += offset_in_block;
 
-		data_block_index = FAT[data_block_index];	// go to the next data block for current file
+		/* Blocks laid out contiguously in memory share an iovec */
+		if (cnt > 0 && (char *)vec[cnt - 1].iov_base + vec[cnt - 1].iov_len == data)
+			vec[cnt - 1].iov_len += chunk;
+		else
+		{
+			vec[cnt].iov_base = data;
+			vec[cnt++].iov_len = chunk;
+		}
+		mapped += chunk;
+		block = fat_next(fs, block);
+	}
 
-		free(bounce_buffer);
+	if (mapped == 0 && count > 0)
+	{
+		// not even one block could be pinned
+		free(vec);
+		unlock_file(fs, f);
+		return -1;
 	}
 
-	fd_table.files[fd].offset = offset;
+	f->maps++;
+	unlock_file(fs, f);
+	*iov = vec;
+	*iovcnt = cnt;
+	return mapped;
+}
 
-	// printf("fs_read() finished %d\n", bytes_read);
-	return bytes_read;
+int fs_read_map_h(fs_t *fs, int fd, size_t offset, size_t count, struct iovec **iov, int *iovcnt)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_read_map(fs, fd, offset, count, iov, iovcnt);
+	trace_call(fs, start, FS_STATS_READ_MAP, ret, fd, count, offset, NULL);
+	return ret;
+}
+
+static int do_read_unmap(struct fs *fs, int fd, struct iovec *iov, int iovcnt)
+{
+	TIME_OP(fs, FS_STATS_READ_UNMAP);
+	struct file *f = lock_file(fs, fd);
+	if (f == NULL)
+		return -1;
+
+	if (f->maps == 0)
+	{
+		// nothing mapped on this fd
+		unlock_file(fs, f);
+		return -1;
+	}
+
+	/* A mapped disk needs no release, and a private copy is freed */
+	if (disk_map(fs->disk, 0) == NULL)
+	{
+		for (int i = 0; i < iovcnt; i++)
+		{
+			if (map_copies(fs))
+				free(iov[i].iov_base);
+			else if (iov[i].iov_len > 0)
+				cache_unpin(fs->cache, iov[i].iov_base, iov[i].iov_len);
+		}
+	}
+	free(iov);
+	f->maps--;
+	unlock_file(fs, f);
+	return 0;
+}
+
+int fs_read_unmap_h(fs_t *fs, int fd, struct iovec *iov, int iovcnt)
+{
+	uint64_t start = trace_begin(fs);
+
+	/* Record how much is released, so that replays can tell mappings apart */
+	size_t count = 0;
+	for (int i = 0; start != 0 && iov != NULL && i < iovcnt; i++)
+		count += iov[i].iov_len;
+
+	int ret = do_read_unmap(fs, fd, iov, iovcnt);
+	trace_call(fs, start, FS_STATS_READ_UNMAP, ret, fd, count, 0, NULL);
+	return ret;
+}
+
+static int do_copy_to_fd(struct fs *fs, int fd, int host_fd, size_t offset, size_t count)
+{
+	TIME_OP(fs, FS_STATS_COPY_TO_FD);
+	struct file *f = lock_file(fs, fd);
+	if (f == NULL)
+		return -1;
+
+	if (offset > f->entry->size)
+	{
+		//offset larger than size
+		unlock_file(fs, f);
+		return -1;
+	}
+	if (count > f->entry->size - offset)
+		count = f->entry->size - offset;
+
+	/* Requests in flight may still be writing to the disk directly */
+	wait_async(fs, f);
+
+	size_t copied = 0;
+	uint16_t block = count > 0 ? get_data_block(fs, f, offset / BLOCK_SIZE, 0) : FAT_EOC;
+	while (copied < count && block != FAT_EOC)
+	{
+		size_t offset_in_block = (offset + copied) % BLOCK_SIZE;
+		size_t remaining = count - copied;
+
+		/* Gather the blocks laid out contiguously on disk into one extent */
+		size_t nblocks = 1;
+		while (nblocks * BLOCK_SIZE - offset_in_block < remaining && fat_next(fs, block + nblocks - 1) == block + nblocks)
+			nblocks++;
+		size_t chunk = nblocks * BLOCK_SIZE - offset_in_block;
+		if (chunk > remaining)
+			chunk = remaining;
+
+		/* The disk must hold the latest data before the kernel reads it */
+		size_t first = fs->sb.data_block_start_index + block;
+		if (cache_flush_range(fs->cache, first, nblocks) == -1 || disk_copy_out(fs->disk, first, offset_in_block, host_fd, chunk) == -1)
+			break;
+
+		copied += chunk;
+		f->cursor_block = block + nblocks - 1;
+		f->cursor_index = (offset + copied - 1) / BLOCK_SIZE;
+		block = fat_next(fs, block + nblocks - 1);
+	}
+	unlock_file(fs, f);
+
+	if (copied == 0 && count > 0)
+		return -1;
+	return copied;
+}
+
+int fs_copy_to_fd_h(fs_t *fs, int fd, int host_fd, size_t offset, size_t count)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_copy_to_fd(fs, fd, host_fd, offset, count);
+	trace_call(fs, start, FS_STATS_COPY_TO_FD, ret, fd, count, offset, NULL);
+	return ret;
+}
+
+/*
+ * Number of blocks to lay out contiguously for the next @bytes bytes copied
+ * into a file. The amount of data the host file descriptor holds is unknown,
+ * so at most one bounded extent is allocated ahead.
+ */
+static size_t copy_extent(size_t bytes)
+{
+	return BLOCKS(bytes) < COPY_EXTENT_MAX ? BLOCKS(bytes) : COPY_EXTENT_MAX;
+}
+
+/*
+ * Return the last data block in the chain of open file @f, and set @len to the
+ * length of the chain. The walk starts from the furthest known position. FAT_EOC
+ * if the chain is empty.
+ */
+static uint16_t chain_tail(struct fs *fs, const struct file *f, size_t *len)
+{
+	uint16_t block = f->entry->first_datablock_index;
+	size_t i = 0;
+	if (f->block_map_len > 0)
+	{
+		i = f->block_map_len - 1;
+		block = f->block_map[i];
+	}
+	if (f->cursor_block != FAT_EOC && f->cursor_index >= i)
+	{
+		block = f->cursor_block;
+		i = f->cursor_index;
+	}
+	if (block == FAT_EOC)
+	{
+		*len = 0;
+		return FAT_EOC;
+	}
+
+	for (uint16_t next = fat_next(fs, block); next != FAT_EOC; next = fat_next(fs, block))
+	{
+		block = next;
+		i++;
+	}
+	*len = i + 1;
+	return block;
+}
+
+static int do_copy_from_fd(struct fs *fs, int fd, int host_fd, size_t offset, size_t count)
+{
+	TIME_OP(fs, FS_STATS_COPY_FROM_FD);
+	struct file *f = lock_file(fs, fd);
+	if (f == NULL)
+		return -1;
+
+	struct root_dir_entry *entry = f->entry;
+	if (offset > entry->size)
+	{
+		//offset larger than size
+		unlock_file(fs, f);
+		return -1;
+	}
+
+	/* Requests in flight may still be writing to the disk directly */
+	wait_async(fs, f);
+
+	/* Blocks are allocated ahead of the data, past the current end of the chain */
+	size_t have = 0;
+	uint16_t tail = count > 0 ? chain_tail(fs, f, &have) : FAT_EOC;
+
+	size_t copied = 0;
+	int failed = 0;
+	uint16_t block = count > 0 ? get_data_block(fs, f, offset / BLOCK_SIZE, copy_extent(offset % BLOCK_SIZE + count)) : FAT_EOC;
+	while (copied < count && block != FAT_EOC)
+	{
+		size_t offset_in_block = (offset + copied) % BLOCK_SIZE;
+		size_t remaining = count - copied;
+		uint16_t pending = FAT_EOC; // next data block, if already known
+
+		size_t want = copy_extent(offset_in_block + remaining);
+		size_t nblocks = 1;
+		while (nblocks < want)
+		{
+			uint16_t next = next_data_block(fs, block + nblocks - 1, want - nblocks);
+			if (next != block + nblocks)
+			{
+				pending = next;
+				break;
+			}
+			nblocks++;
+		}
+		size_t chunk = nblocks * BLOCK_SIZE - offset_in_block;
+		if (chunk > remaining)
+			chunk = remaining;
+
+		/*
+		 * The kernel writes the disk directly: no dirty cached copy may be
+		 * written back over the new data, and the cached copies are then
+		 * refreshed from it
+		 */
+		size_t first = fs->sb.data_block_start_index + block;
+		if (cache_flush_range(fs->cache, first, nblocks) == -1)
+		{
+			failed = 1;
+			break;
+		}
+		ssize_t ret = disk_copy_in(fs->disk, first, offset_in_block, host_fd, chunk);
+		if (cache_reload(fs->cache, first, nblocks) == -1 || ret == -1)
+		{
+			failed = 1;
+			break;
+		}
+
+		copied += ret;
+		if (ret > 0)
+		{
+			f->cursor_block = block + BLOCKS(offset_in_block + ret) - 1;
+			f->cursor_index = (offset + copied - 1) / BLOCK_SIZE;
+		}
+		if ((size_t)ret < chunk || copied == count)
+			break; // end of the data of @host_fd
+
+		block = pending != FAT_EOC ? pending : next_data_block(fs, block + nblocks - 1, copy_extent(count - copied));
+	}
+
+	/* Writing past the end of the file extends it */
+	int extended = offset + copied > entry->size;
+	if (extended)
+		entry->size = offset + copied;
+
+	/*
+	 * The data of @host_fd may end before the blocks allocated for it: give
+	 * back the ones past both the old end of the chain and the new end of the
+	 * file. If the file grew, the cursor is on its last block.
+	 */
+	size_t keep = BLOCKS(entry->size) > have ? BLOCKS(entry->size) : have;
+	if (BLOCKS(entry->size) > have)
+		tail = f->cursor_block;
+	uint16_t extra = count == 0 ? FAT_EOC : tail == FAT_EOC ? entry->first_datablock_index : fat_next(fs, tail);
+	if (extended || extra != FAT_EOC)
+	{
+		pthread_mutex_lock(&fs->alloc_lock);
+		if (extra != FAT_EOC)
+		{
+			if (tail == FAT_EOC)
+			{
+				entry->first_datablock_index = FAT_EOC;
+				fs->root_dir_dirty = 1;
+			}
+			else
+				set_FAT(fs, tail, FAT_EOC);
+			while (extra != FAT_EOC)
+			{
+				uint16_t next = fat_next(fs, extra);
+				free_data_block(fs, extra);
+				extra = next;
+			}
+			if (f->block_map_len > keep)
+				f->block_map_len = keep;
+		}
+		if (extended)
+			fs->root_dir_dirty = 1;
+		metadata_updated(fs);
+		pthread_mutex_unlock(&fs->alloc_lock);
+	}
+	unlock_file(fs, f);
+	commit_if_due(fs);
+
+	if (failed && copied == 0)
+		return -1;
+	return copied;
+}
+
+int fs_copy_from_fd_h(fs_t *fs, int fd, int host_fd, size_t offset, size_t count)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_copy_from_fd(fs, fd, host_fd, offset, count);
+	trace_call(fs, start, FS_STATS_COPY_FROM_FD, ret, fd, count, offset, NULL);
+	return ret;
+}
+
+/* Start the asynchronous I/O engine of @fs on first use */
+static int start_aio(struct fs *fs)
+{
+	pthread_mutex_lock(&fs->async_lock);
+	if (fs->aio == NULL)
+		fs->aio = aio_create(fs->disk, async_depth, async_flags);
+	int ret = fs->aio == NULL ? -1 : 0;
+	pthread_mutex_unlock(&fs->async_lock);
+	return ret;
+}
+
+/*
+ * Submit an asynchronous read or write of @count bytes at the offset of @fd.
+ * The offset moves as the call submits the request, and the blocks are
+ * allocated and the file size updated at that time, so that requests issued
+ * back to back cover consecutive ranges.
+ */
+static int file_async(struct fs *fs, int fd, void *buf, size_t count, fs_async_callback_t callback, void *arg, int write)
+{
+	/* Only the submission is timed, the callback tells when the data is there */
+	TIME_OP(fs, write ? FS_STATS_WRITE_ASYNC : FS_STATS_READ_ASYNC);
+	if (fs == NULL || buf == NULL || callback == NULL)
+		return -1;
+
+	if (start_aio(fs) == -1)
+		return -1;
+
+	struct async_request *req = calloc(1, sizeof(struct async_request));
+	if (req == NULL)
+		return -1;
+
+	struct file *f = lock_file(fs, fd);
+	if (f == NULL)
+	{
+		free(req);
+		return -1;
+	}
+
+	req->fs = fs;
+	req->f = f;
+	req->fd = fd;
+	req->callback = callback;
+	req->arg = arg;
+	req->pending = 1;
+	pthread_mutex_lock(&fs->async_lock);
+	f->async_inflight++;
+	fs->async_inflight++;
+	pthread_mutex_unlock(&fs->async_lock);
+
+	int ret;
+	if (write)
+		ret = count == 0 ? 0 : file_write(fs, f, f->offset, buf, count, req);
+	else
+		ret = file_read(fs, f, f->offset, buf, count, req, 0);
+	if (ret > 0)
+		f->offset += ret;
+	unlock_file(fs, f);
+
+	/* Errors are reported through the callback, like the ones of the block requests */
+	req->bytes = ret;
+	async_put(req, ret == -1);
+
+	/* Only possible if every request is already complete */
+	commit_if_due(fs);
+	return 0;
+}
+
+int fs_read_async_h(fs_t *fs, int fd, void *buf, size_t count, fs_async_callback_t callback, void *arg)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = file_async(fs, fd, buf, count, callback, arg, 0);
+	trace_call(fs, start, FS_STATS_READ_ASYNC, ret, fd, count, 0, NULL);
+	return ret;
+}
+
+int fs_write_async_h(fs_t *fs, int fd, void *buf, size_t count, fs_async_callback_t callback, void *arg)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = file_async(fs, fd, buf, count, callback, arg, 1);
+	trace_call(fs, start, FS_STATS_WRITE_ASYNC, ret, fd, count, 0, NULL);
+	return ret;
+}
+
+static int do_async_wait(struct fs *fs)
+{
+	TIME_OP(fs, FS_STATS_ASYNC_WAIT);
+	if (fs == NULL)
+		return -1;
+
+	pthread_mutex_lock(&fs->async_lock);
+	while (fs->async_inflight > 0)
+		pthread_cond_wait(&fs->async_done, &fs->async_lock);
+	pthread_mutex_unlock(&fs->async_lock);
+
+	/* The updates held back by the requests can be committed now */
+	commit_if_due(fs);
+	return 0;
+}
+
+int fs_async_wait_h(fs_t *fs)
+{
+	uint64_t start = trace_begin(fs);
+	int ret = do_async_wait(fs);
+	trace_call(fs, start, FS_STATS_ASYNC_WAIT, ret, -1, 0, 0, NULL);
+	return ret;
+}
+
+/*
+ * Calls without a handle, operating on the file system mounted by fs_mount() or
+ * fs_mount_mmap()
+ */
+
+int fs_sync(void)
+{
+	return fs_sync_h(default_fs);
+}
+
+int fs_journal_create(size_t nr_blocks)
+{
+	return fs_journal_create_h(default_fs, nr_blocks);
+}
+
+int fs_cache_flush(void)
+{
+	return fs_cache_flush_h(default_fs);
+}
+
+int fs_cache_stats(struct fs_cache_stats *stats)
+{
+	return fs_cache_stats_h(default_fs, stats);
+}
+
+int fs_stats(struct fs_stats *stats)
+{
+	return fs_stats_h(default_fs, stats);
+}
+
+int fs_trace_start(const char *filename)
+{
+	return fs_trace_start_h(default_fs, filename);
+}
+
+int fs_trace_stop(void)
+{
+	return fs_trace_stop_h(default_fs);
+}
+
+int fs_info(void)
+{
+	return fs_info_h(default_fs);
+}
+
+int fs_create(const char *filename)
+{
+	return fs_create_h(default_fs, filename);
+}
+
+int fs_delete(const char *filename)
+{
+	return fs_delete_h(default_fs, filename);
+}
+
+int fs_ls(void)
+{
+	return fs_ls_h(default_fs);
+}
+
+int fs_open(const char *filename)
+{
+	return fs_open_h(default_fs, filename);
+}
+
+int fs_close(int fd)
+{
+	return fs_close_h(default_fs, fd);
+}
+
+int fs_fsync(int fd)
+{
+	return fs_fsync_h(default_fs, fd);
+}
+
+int fs_stat(int fd)
+{
+	return fs_stat_h(default_fs, fd);
+}
+
+int fs_lseek(int fd, size_t offset)
+{
+	return fs_lseek_h(default_fs, fd, offset);
+}
+
+int fs_write(int fd, void *buf, size_t count)
+{
+	return fs_write_h(default_fs, fd, buf, count);
+}
+
+int fs_reserve(int fd, size_t bytes)
+{
+	return fs_reserve_h(default_fs, fd, bytes);
+}
+
+int fs_read(int fd, void *buf, size_t count)
+{
+	return fs_read_h(default_fs, fd, buf, count);
+}
+
+int fs_read_map(int fd, size_t offset, size_t count, struct iovec **iov, int *iovcnt)
+{
+	return fs_read_map_h(default_fs, fd, offset, count, iov, iovcnt);
+}
+
+int fs_read_unmap(int fd, struct iovec *iov, int iovcnt)
+{
+	return fs_read_unmap_h(default_fs, fd, iov, iovcnt);
+}
+
+int fs_copy_to_fd(int fd, int host_fd, size_t offset, size_t count)
+{
+	return fs_copy_to_fd_h(default_fs, fd, host_fd, offset, count);
+}
+
+int fs_copy_from_fd(int fd, int host_fd, size_t offset, size_t count)
+{
+	return fs_copy_from_fd_h(default_fs, fd, host_fd, offset, count);
+}
+
+int fs_pwrite(int fd, void *buf, size_t count, size_t offset)
+{
+	return fs_pwrite_h(default_fs, fd, buf, count, offset);
+}
+
+int fs_pread(int fd, void *buf, size_t count, size_t offset)
+{
+	return fs_pread_h(default_fs, fd, buf, count, offset);
+}
+
+int fs_read_async(int fd, void *buf, size_t count, fs_async_callback_t callback, void *arg)
+{
+	return fs_read_async_h(default_fs, fd, buf, count, callback, arg);
+}
+
+int fs_write_async(int fd, void *buf, size_t count, fs_async_callback_t callback, void *arg)
+{
+	return fs_write_async_h(default_fs, fd, buf, count, callback, arg);
+}
+
+int fs_async_wait(void)
+{
+	return fs_async_wait_h(default_fs);
 }
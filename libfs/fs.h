@@ -2,6 +2,8 @@
 #define _FS_H
 
 #include <stddef.h> /* for size_t definition */
+#include <stdint.h> /* for the trace record fields */
+#include <sys/uio.h> /* for struct iovec definition */
 
 /** Maximum filename length (including the NULL character) */
 #define FS_FILENAME_LEN 16
@@ -12,6 +14,145 @@
 /** Maximum number of open files */
 #define FS_OPEN_MAX_COUNT 32
 
+/** Default number of blocks held in memory by the block cache */
+#define FS_CACHE_DEFAULT_BLOCKS 64
+
+/** Default number of block requests in flight for asynchronous I/O */
+#define FS_ASYNC_DEFAULT_DEPTH 64
+
+/** Block cache statistics, see fs_cache_stats() */
+struct fs_cache_stats {
+	size_t hits;		/* Block lookups served from memory */
+	size_t misses;		/* Block lookups that went to the disk */
+	size_t evictions;	/* Blocks dropped to make room for others */
+	size_t writebacks;	/* Dirty blocks written back to the disk */
+};
+
+/** File system calls timed by fs_stats() */
+enum fs_stats_op {
+	FS_STATS_CREATE,
+	FS_STATS_DELETE,
+	FS_STATS_OPEN,
+	FS_STATS_CLOSE,
+	FS_STATS_FSYNC,
+	FS_STATS_STAT,
+	FS_STATS_LSEEK,
+	FS_STATS_READ,
+	FS_STATS_WRITE,
+	FS_STATS_PREAD,
+	FS_STATS_PWRITE,
+	FS_STATS_RESERVE,
+	FS_STATS_READ_MAP,
+	FS_STATS_COPY_TO_FD,
+	FS_STATS_COPY_FROM_FD,
+	FS_STATS_SYNC,
+	FS_STATS_READ_UNMAP,
+	FS_STATS_READ_ASYNC,
+	FS_STATS_WRITE_ASYNC,
+	FS_STATS_ASYNC_WAIT,
+	FS_STATS_OPS
+};
+
+/** Number of buckets of the latency histograms of fs_stats() */
+#define FS_STATS_BUCKETS 32
+
+/** Latency of a file system call, see fs_stats() */
+struct fs_stats_latency {
+	size_t calls;		/* Number of calls */
+	size_t total_ns;	/* Total time spent in the calls */
+	/* Bucket i counts the calls that took [2^i, 2^(i+1)) ns, the last one
+	 * also counts the longer ones */
+	size_t buckets[FS_STATS_BUCKETS];
+};
+
+/** File system instrumentation, see fs_stats() */
+struct fs_stats {
+	int enabled;		/* 0 if libfs was built without instrumentation */
+	size_t block_reads;	/* Read requests sent to the disk */
+	size_t block_writes;	/* Write requests sent to the disk */
+	size_t bytes_read;	/* Bytes read from the disk */
+	size_t bytes_written;	/* Bytes written to the disk */
+	size_t fat_hops;	/* FAT entries followed while walking chains */
+	size_t dir_lookups;	/* Root directory lookups by filename */
+	size_t allocations;	/* Data block allocation requests */
+	size_t blocks_allocated; /* Data blocks allocated by these requests */
+	size_t bounce_copies;	/* Partial blocks copied through a block buffer */
+	size_t bounce_bytes;	/* Bytes copied by these copies */
+	struct fs_stats_latency ops[FS_STATS_OPS]; /* Indexed by enum fs_stats_op */
+};
+
+/** Signature of trace files, see fs_trace_start() */
+#define FS_TRACE_SIGNATURE "ECSTRACE"
+
+/**
+ * Version of the trace file format. Version 1 traces lack the calls added since
+ * (e.g., fs_read_unmap() and the asynchronous ones).
+ */
+#define FS_TRACE_VERSION 2
+
+/** Header of a trace file */
+struct fs_trace_header {
+	char signature[8];	/* FS_TRACE_SIGNATURE */
+	uint32_t version;	/* FS_TRACE_VERSION */
+	uint32_t reserved;
+} __attribute__((packed));
+
+/**
+ * Traced call, following the header in a trace file. Calls that name a file
+ * (create, delete, open) are followed by the @name_len bytes of its name.
+ */
+struct fs_trace_record {
+	uint64_t start_ns;	/* When the call started, since fs_trace_start() */
+	uint32_t duration_ns;	/* Time spent in the call (saturated) */
+	uint32_t count;		/* Bytes requested, if any */
+	uint32_t offset;	/* Offset argument, if any */
+	int32_t ret;		/* Return value */
+	int16_t fd;		/* File descriptor argument, if any */
+	uint8_t op;		/* Call, as an enum fs_stats_op */
+	uint8_t name_len;	/* Length of the filename following the record */
+} __attribute__((packed));
+
+/** Mounted file system handle, see fs_mount_h() */
+typedef struct fs fs_t;
+
+/**
+ * typedef fs_async_callback_t - Completion callback of an asynchronous request
+ * @fd: File descriptor the request was submitted on
+ * @ret: Number of bytes transferred, or -1 if the request failed
+ * @arg: Argument given when the request was submitted
+ */
+typedef void (*fs_async_callback_t)(int fd, int ret, void *arg);
+
+/** Leave the blocks of a new virtual disk unallocated on the host, see fs_format() */
+#define FS_FORMAT_SPARSE 0x1
+
+/**
+ * fs_format - Create a virtual disk holding an empty file system
+ * @diskname: Name of the virtual disk file
+ * @data_blocks: Number of data blocks
+ * @journal_blocks: Number of blocks in the journal region, or 0 for none
+ * @index_blocks: Number of blocks in the reserved index region, or 0 for none
+ * @flags: FS_FORMAT_SPARSE, or 0
+ *
+ * Create virtual disk file @diskname, replacing any existing one, and format it
+ * with an empty file system of @data_blocks data blocks. Only the superblock,
+ * the FAT and the root directory are written, with a single request, since the
+ * rest of the new file reads as zeros. The host file system allocates the whole
+ * file upfront, unless FS_FORMAT_SPARSE is set.
+ *
+ * A journal region is set up as with fs_journal_create(). The index region is
+ * recorded in the superblock and allocated in the FAT, so that files never use
+ * its blocks, but is otherwise left alone for an on-disk index to live in.
+ * Both are contiguous and come first among the data blocks.
+ *
+ * Return: -1 if the geometry does not fit in the file system format (e.g., more
+ * than about 65,000 blocks in total, or a journal too small to hold every
+ * metadata block), or if the virtual disk file cannot be created or written.
+ * 0 otherwise.
+ */
+int fs_format(const char *diskname, size_t data_blocks, size_t journal_blocks,
+	      size_t index_blocks, int flags);
+
 /**
  * fs_mount - Mount a file system
  * @diskname: Name of the virtual disk file
@@ -25,6 +166,20 @@
  */
 int fs_mount(const char *diskname);
 
+/**
+ * fs_mount_mmap - Mount a file system from a memory-mapped disk
+ * @diskname: Name of the virtual disk file
+ *
+ * Same as fs_mount(), but the whole virtual disk file is mapped in memory and
+ * file data is copied directly between the mapping and the buffers given to
+ * fs_read() and fs_write(). The block cache is not used in this mode, and the
+ * mapping is synchronized with the virtual disk file by fs_umount().
+ *
+ * Return: -1 if virtual disk file @diskname cannot be opened or mapped, or if no
+ * valid file system can be located. 0 otherwise.
+ */
+int fs_mount_mmap(const char *diskname);
+
 /**
  * fs_umount - Unmount file system
  *
@@ -36,6 +191,145 @@ int fs_mount(const char *diskname);
  */
 int fs_umount(void);
 
+/**
+ * fs_sync - Synchronize file system
+ *
+ * Write back to the virtual disk the superblock, FAT and root directory blocks
+ * modified since they were last written, along with all the dirty blocks held
+ * by the block cache, and wait until they reach stable storage. Unmodified
+ * metadata blocks are not rewritten, so this can be called periodically at a
+ * low cost. fs_umount() does the same before closing the virtual disk.
+ *
+ * Return: -1 if no FS is currently mounted, or if a block cannot be written
+ * back. 0 otherwise.
+ */
+int fs_sync(void);
+
+/**
+ * fs_sync_config - Configure group commit
+ * @max_latency_ms: Maximum delay before fs_fsync() data is durable, in
+ * milliseconds
+ *
+ * With a @max_latency_ms of 0 (the default), fs_fsync() waits until the data
+ * reaches stable storage; concurrent calls still share a single fdatasync() of
+ * the virtual disk. Otherwise, fs_fsync() returns once the data is written to
+ * the virtual disk, and a background thread makes it durable at most
+ * @max_latency_ms milliseconds later, with a single fdatasync() covering every
+ * fs_fsync() issued in between. This bounds the data lost in a crash while
+ * letting many small-file writes share the cost of a sync.
+ *
+ * Return: 0.
+ */
+int fs_sync_config(unsigned int max_latency_ms);
+
+/**
+ * fs_journal_create - Add a metadata journal to the file system
+ * @nr_blocks: Number of blocks in the journal region
+ *
+ * Reserve @nr_blocks contiguous data blocks for a write-ahead journal, and
+ * record it in the superblock. From then on, fs_sync() and fs_umount() first
+ * log the modified metadata blocks to the journal as a single transaction, and
+ * fs_mount() replays the last transaction if writing them in place got
+ * interrupted, so that the FAT and the root directory stay consistent with each
+ * other after a crash. Metadata updates are also committed automatically every
+ * few operations, so a crash loses at most the last few of them.
+ *
+ * Return: -1 if no FS is currently mounted, or if it already has a journal, or
+ * if @nr_blocks is too small to hold every metadata block, or if there are not
+ * @nr_blocks contiguous free data blocks. 0 otherwise.
+ */
+int fs_journal_create(size_t nr_blocks);
+
+/**
+ * fs_cache_config - Configure the block cache
+ * @nr_blocks: Number of blocks the cache can hold
+ *
+ * Set the size of the write-back block cache used by the next fs_mount(). All
+ * disk blocks accessed by the file system, metadata and data alike, are served
+ * from this cache and evicted in least recently used order. A size of 0
+ * disables the cache. The default size is %FS_CACHE_DEFAULT_BLOCKS blocks.
+ *
+ * Return: -1 if a FS is currently mounted. 0 otherwise.
+ */
+int fs_cache_config(size_t nr_blocks);
+
+/**
+ * fs_cache_flush - Flush the block cache
+ *
+ * Write all the dirty blocks held by the block cache back to the virtual disk.
+ * Dirty blocks are otherwise written back when evicted, or by fs_umount().
+ *
+ * Return: -1 if no FS is currently mounted, or if a block cannot be written
+ * back. 0 otherwise.
+ */
+int fs_cache_flush(void);
+
+/**
+ * fs_cache_budget - Limit the memory used by all the block caches
+ * @nr_blocks: Number of blocks all the block caches can hold together
+ *
+ * Every mount takes the capacity of its block cache, as set by
+ * fs_cache_config(), from a budget shared by all the mounted file systems, and
+ * gives it back when unmounted. Once the budget is exhausted, new mounts get a
+ * smaller cache, possibly a pass-through one. The budget is unlimited by
+ * default. Lowering it does not shrink the caches of mounted file systems.
+ *
+ * Return: 0.
+ */
+int fs_cache_budget(size_t nr_blocks);
+
+/**
+ * fs_cache_stats - Get block cache statistics
+ * @stats: Statistics to be filled
+ *
+ * Fill @stats with the hit, miss, eviction and write-back counters of the block
+ * cache since the file system was mounted.
+ *
+ * Return: -1 if no FS is currently mounted, or if @stats is NULL. 0 otherwise.
+ */
+int fs_cache_stats(struct fs_cache_stats *stats);
+
+/**
+ * fs_stats - Get file system instrumentation
+ * @stats: Statistics to be filled
+ *
+ * Fill @stats with the counters and latency histograms of the currently
+ * mounted file system, accumulated since it was mounted. Disk requests include
+ * the ones of the block cache and of the metadata write-back, and bounce copies
+ * include the partial copies of fs_copy_to_fd() and fs_copy_from_fd() when the
+ * kernel cannot copy on its own. The latency of fs_read_async() and
+ * fs_write_async() only covers the submission of the request.
+ *
+ * Instrumentation is compiled out when libfs is built with `make STATS=0`, in
+ * which case @stats is filled with zeros.
+ *
+ * Return: -1 if no FS is currently mounted, or if @stats is NULL. 0 otherwise.
+ */
+int fs_stats(struct fs_stats *stats);
+
+/**
+ * fs_trace_start - Start recording the calls made on the file system
+ * @filename: Name of the host file receiving the trace
+ *
+ * From now on, every call timed by fs_stats() is appended to trace file
+ * @filename (created, or truncated), with its arguments, return value and
+ * timing, but not the data it transfers. Recording stops with fs_trace_stop(),
+ * or when the file system is unmounted. A trace can be re-executed with
+ * `test_fs.x replay`.
+ *
+ * Return: -1 if no FS is currently mounted, or if a trace is already being
+ * recorded, or if @filename cannot be created. 0 otherwise.
+ */
+int fs_trace_start(const char *filename);
+
+/**
+ * fs_trace_stop - Stop recording the calls made on the file system
+ *
+ * Return: -1 if no FS is currently mounted, or if no trace is being recorded,
+ * or if the trace file cannot be written. 0 otherwise.
+ */
+int fs_trace_stop(void);
+
 /**
  * fs_info - Display information about file system
  *
@@ -105,13 +399,29 @@ int fs_open(const char *filename);
  * fs_close - Close a file
  * @fd: File descriptor
  *
- * Close file descriptor @fd.
+ * Close file descriptor @fd, once its asynchronous requests have completed.
  *
  * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
- * invalid (out of bounds or not currently open). 0 otherwise.
+ * invalid (out of bounds or not currently open), or if data of the file is
+ * still mapped with fs_read_map(). 0 otherwise.
  */
 int fs_close(int fd);
 
+/**
+ * fs_fsync - Synchronize a file
+ * @fd: File descriptor
+ *
+ * Write back the data and metadata blocks of the file referenced by file
+ * descriptor @fd, and make them durable as configured by fs_sync_config(). As
+ * with fs_sync(), only the blocks modified since they were last written are
+ * written, which may include blocks of other files.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if the blocks cannot be
+ * written back, or if a previous group commit failed. 0 otherwise.
+ */
+int fs_fsync(int fd);
+
 /**
  * fs_stat - Get file status
  * @fd: File descriptor
@@ -161,6 +471,23 @@ int fs_lseek(int fd, size_t offset);
  */
 int fs_write(int fd, void *buf, size_t count);
 
+/**
+ * fs_reserve - Preallocate space for a file
+ * @fd: File descriptor
+ * @bytes: Number of bytes to reserve
+ *
+ * Make sure that the data blocks needed to hold the first @bytes bytes of the
+ * file referenced by file descriptor @fd are allocated, as physically
+ * contiguous as the free space allows. The size of the file is left unchanged,
+ * and subsequent writes within the first @bytes bytes of the file cannot run
+ * out of space.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if there is not enough
+ * free space on disk to reserve @bytes bytes. 0 otherwise.
+ */
+int fs_reserve(int fd, size_t bytes);
+
 /**
  * fs_read - Read from a file
  * @fd: File descriptor
@@ -176,10 +503,289 @@ int fs_write(int fd, void *buf, size_t count);
  * is at the end of the file). The file offset of the file descriptor is
  * implicitly incremented by the number of bytes that were actually read.
  *
+ * Reads that start where the previous one on @fd ended are detected as
+ * sequential: the next blocks of the file are then loaded into the block cache
+ * ahead of time, in a window that grows as long as the accesses stay
+ * sequential and closes on a seek.
+ *
  * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
  * invalid (out of bounds or not currently open), or if @buf is NULL. Otherwise
  * return the number of bytes actually read.
  */
 int fs_read(int fd, void *buf, size_t count);
 
+/**
+ * fs_pwrite - Write to a file at a given offset
+ * @fd: File descriptor
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes of data to be written
+ * @offset: File offset to write at
+ *
+ * Same as fs_write(), but the data is written at @offset instead of the file
+ * offset of @fd, which is left unchanged. Threads sharing @fd can thus access
+ * different parts of the file without fs_lseek() races.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if @buf is NULL, or if
+ * @offset is larger than the current file size. Otherwise return the number of
+ * bytes actually written.
+ */
+int fs_pwrite(int fd, void *buf, size_t count, size_t offset);
+
+/**
+ * fs_pread - Read from a file at a given offset
+ * @fd: File descriptor
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ * @offset: File offset to read from
+ *
+ * Same as fs_read(), but the data is read from @offset instead of the file
+ * offset of @fd, which is left unchanged. Positional reads of a file do not
+ * wait for each other.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if @buf is NULL, or if
+ * @offset is larger than the current file size. Otherwise return the number of
+ * bytes actually read.
+ */
+int fs_pread(int fd, void *buf, size_t count, size_t offset);
+
+/**
+ * fs_read_map - Get direct access to the data of a file
+ * @fd: File descriptor
+ * @offset: File offset of the first byte to access
+ * @count: Number of bytes to access
+ * @iov: Set to an array of buffers holding the data
+ * @iovcnt: Set to the number of buffers in @iov
+ *
+ * Instead of copying the data like fs_pread(), describe where it already lives
+ * in memory: in the mapping of the virtual disk when mounted with
+ * fs_mount_mmap(), or in the block cache otherwise, where the blocks stay
+ * pinned until fs_read_unmap(). The buffers can be handed to writev() or
+ * vmsplice() as is. They must not be written to, and show the changes made to
+ * the file meanwhile. Without a block cache, or with a single block of cache
+ * (which cannot stay pinned), the data is copied to a private buffer.
+ *
+ * Fewer than @count bytes are mapped at the end of the file, or when half of
+ * the block cache is already pinned. The file offset of @fd is left unchanged,
+ * and fs_close() fails until every mapping of @fd is released.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if @iov or @iovcnt is
+ * NULL, or if @offset is larger than the current file size, or if no block can
+ * be mapped. Otherwise return the number of bytes mapped, which must be
+ * released with fs_read_unmap() even if 0.
+ */
+int fs_read_map(int fd, size_t offset, size_t count, struct iovec **iov,
+		int *iovcnt);
+
+/**
+ * fs_read_unmap - Release a mapping of the data of a file
+ * @fd: File descriptor given to fs_read_map()
+ * @iov: Buffers returned by fs_read_map()
+ * @iovcnt: Number of buffers returned by fs_read_map()
+ *
+ * Unpin the blocks described by @iov, and free @iov.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if nothing is mapped on
+ * @fd. 0 otherwise.
+ */
+int fs_read_unmap(int fd, struct iovec *iov, int iovcnt);
+
+/**
+ * fs_copy_to_fd - Copy part of a file to a host file descriptor
+ * @fd: File descriptor
+ * @host_fd: Host file descriptor, written at its current file position
+ * @offset: File offset to copy from
+ * @count: Number of bytes of data to be copied
+ *
+ * Export the data of the file without buffering it in user space: each run of
+ * data blocks laid out contiguously on the disk is handed to the kernel with a
+ * single copy_file_range() (or sendfile() or splice(), depending on what
+ * @host_fd is). As with fs_pread(), the file offset of @fd is left unchanged.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if @offset is larger than
+ * the current file size, or if nothing could be written to @host_fd. Otherwise
+ * return the number of bytes actually copied.
+ */
+int fs_copy_to_fd(int fd, int host_fd, size_t offset, size_t count);
+
+/**
+ * fs_copy_from_fd - Copy data from a host file descriptor into a file
+ * @fd: File descriptor
+ * @host_fd: Host file descriptor, read from its current file position
+ * @offset: File offset to write at
+ * @count: Maximum number of bytes of data to be copied
+ *
+ * Same as fs_copy_to_fd(), the other way around: the data of @host_fd is
+ * written at @offset like with fs_pwrite(), extending the file if needed. The
+ * copy stops early at the end of the data of @host_fd, or when the disk runs
+ * out of space.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if @offset is larger than
+ * the current file size, or if nothing could be read from @host_fd. Otherwise
+ * return the number of bytes actually copied.
+ */
+int fs_copy_from_fd(int fd, int host_fd, size_t offset, size_t count);
+
+/**
+ * fs_async_config - Configure asynchronous I/O
+ * @depth: Maximum number of block requests in flight per file system
+ * @use_threads: Whether to use a pool of worker threads even if io_uring is
+ * available
+ *
+ * Set up the engine serving fs_read_async() and fs_write_async() for the next
+ * fs_mount(). Block requests are submitted to io_uring, or performed by up to
+ * 16 worker threads when io_uring is not available. The default depth is
+ * %FS_ASYNC_DEFAULT_DEPTH.
+ *
+ * Return: -1 if a FS is currently mounted. 0 otherwise.
+ */
+int fs_async_config(unsigned int depth, int use_threads);
+
+/**
+ * fs_read_async - Read from a file without waiting for the disk
+ * @fd: File descriptor
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ * @callback: Called once the data is in @buf
+ * @arg: Argument given to @callback
+ *
+ * Same as fs_read(), but the data blocks are read in the background: the file
+ * offset moves and the call returns as soon as the requests are submitted, so
+ * that a single thread can keep many requests in flight. Blocks held by the
+ * block cache and the partial blocks at either end of the range are copied
+ * before returning. Contiguous blocks of the FAT chain are read with a single
+ * request.
+ *
+ * @callback receives the number of bytes read, or -1, and runs on an internal
+ * thread: it must not wait for other requests, nor call the file system. @buf
+ * must stay valid until then.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if @buf or @callback is
+ * NULL, or if asynchronous I/O cannot be started. 0 otherwise, in which case
+ * @callback is called exactly once.
+ */
+int fs_read_async(int fd, void *buf, size_t count, fs_async_callback_t callback,
+		  void *arg);
+
+/**
+ * fs_write_async - Write to a file without waiting for the disk
+ * @fd: File descriptor
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes of data to be written
+ * @callback: Called once the data is written to the disk
+ * @arg: Argument given to @callback
+ *
+ * Same as fs_write(), but the data blocks are written in the background: the
+ * blocks are allocated, the file grows, the file offset moves and the call
+ * returns as soon as the requests are submitted. Partial blocks at either end
+ * of the range go through the block cache before returning.
+ *
+ * Until the callback runs, the content of the written range is undefined for
+ * other accesses. fs_fsync() and fs_close() wait for the requests in flight on
+ * @fd. The new size and blocks of the file are not written back to the disk
+ * before the data: fs_sync() and fs_fsync() wait for every request in flight,
+ * and the metadata updates committed automatically with a journal are delayed
+ * until a call finds none, such as fs_async_wait(). See fs_read_async() for
+ * the constraints on @callback and @buf.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if @buf or @callback is
+ * NULL, or if asynchronous I/O cannot be started. 0 otherwise, in which case
+ * @callback is called exactly once.
+ */
+int fs_write_async(int fd, void *buf, size_t count,
+		   fs_async_callback_t callback, void *arg);
+
+/**
+ * fs_async_wait - Wait for the asynchronous requests in flight
+ *
+ * Return once the callbacks of all the requests submitted so far have run.
+ * With a journal, the metadata updates held back by the requests are then
+ * committed if enough of them are pending.
+ *
+ * Return: -1 if no FS is currently mounted. 0 otherwise.
+ */
+int fs_async_wait(void);
+
+/*
+ * Handle API: the calls above operate on the single file system mounted by
+ * fs_mount() or fs_mount_mmap(). fs_mount_h() and fs_mount_mmap_h() mount a
+ * file system as a separate instance, with its own disk, FAT, root directory,
+ * file descriptors and block cache, so that a process can serve several file
+ * systems at once. Each *_h() call behaves as the call of the same name, on
+ * file system @fs, and fails if @fs is NULL.
+ */
+
+/**
+ * fs_mount_h - Mount a file system as a new instance
+ * @diskname: Name of the virtual disk file
+ *
+ * Return: NULL if virtual disk file @diskname cannot be opened, or if no valid
+ * file system can be located. The handle of the mounted file system otherwise.
+ */
+fs_t *fs_mount_h(const char *diskname);
+
+/**
+ * fs_mount_mmap_h - Mount a file system from a memory-mapped disk as a new
+ * instance
+ * @diskname: Name of the virtual disk file
+ *
+ * Return: NULL if virtual disk file @diskname cannot be opened or mapped, or if
+ * no valid file system can be located. The handle of the mounted file system
+ * otherwise.
+ */
+fs_t *fs_mount_mmap_h(const char *diskname);
+
+/**
+ * fs_umount_h - Unmount a file system instance
+ * @fs: File system handle
+ *
+ * Once this returns 0, or -1 because the virtual disk could not be cleanly
+ * closed, @fs is released and must not be used anymore. It is kept mounted if
+ * there are still open file descriptors or if writing back fails.
+ *
+ * Return: -1 if @fs is NULL or cannot be cleanly unmounted. 0 otherwise.
+ */
+int fs_umount_h(fs_t *fs);
+
+int fs_sync_h(fs_t *fs);
+int fs_journal_create_h(fs_t *fs, size_t nr_blocks);
+int fs_cache_flush_h(fs_t *fs);
+int fs_cache_stats_h(fs_t *fs, struct fs_cache_stats *stats);
+int fs_stats_h(fs_t *fs, struct fs_stats *stats);
+int fs_trace_start_h(fs_t *fs, const char *filename);
+int fs_trace_stop_h(fs_t *fs);
+int fs_info_h(fs_t *fs);
+int fs_create_h(fs_t *fs, const char *filename);
+int fs_delete_h(fs_t *fs, const char *filename);
+int fs_ls_h(fs_t *fs);
+int fs_open_h(fs_t *fs, const char *filename);
+int fs_close_h(fs_t *fs, int fd);
+int fs_fsync_h(fs_t *fs, int fd);
+int fs_stat_h(fs_t *fs, int fd);
+int fs_lseek_h(fs_t *fs, int fd, size_t offset);
+int fs_write_h(fs_t *fs, int fd, void *buf, size_t count);
+int fs_reserve_h(fs_t *fs, int fd, size_t bytes);
+int fs_read_h(fs_t *fs, int fd, void *buf, size_t count);
+int fs_pwrite_h(fs_t *fs, int fd, void *buf, size_t count, size_t offset);
+int fs_pread_h(fs_t *fs, int fd, void *buf, size_t count, size_t offset);
+int fs_read_map_h(fs_t *fs, int fd, size_t offset, size_t count,
+		  struct iovec **iov, int *iovcnt);
+int fs_read_unmap_h(fs_t *fs, int fd, struct iovec *iov, int iovcnt);
+int fs_copy_to_fd_h(fs_t *fs, int fd, int host_fd, size_t offset,
+		    size_t count);
+int fs_copy_from_fd_h(fs_t *fs, int fd, int host_fd, size_t offset,
+		      size_t count);
+int fs_read_async_h(fs_t *fs, int fd, void *buf, size_t count,
+		    fs_async_callback_t callback, void *arg);
+int fs_write_async_h(fs_t *fs, int fd, void *buf, size_t count,
+		     fs_async_callback_t callback, void *arg);
+int fs_async_wait_h(fs_t *fs);
+
 #endif /* _FS_H */
@@ -0,0 +1,238 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "disk.h"
+#include "journal.h"
+
+#define journal_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define DESC_SIGNATURE "ECSJDESC"
+#define COMMIT_SIGNATURE "ECSJCMIT"
+
+/* Maximum number of blocks a descriptor can describe */
+#define DESC_MAX_BLOCKS ((BLOCK_SIZE - 14) / 2)
+
+/*
+ * On-disk layout of a transaction, starting at the first block of the journal
+ * region: a descriptor, the logged blocks, and a commit record. A descriptor
+ * with no blocks means the journal is empty.
+ */
+struct descriptor {
+	char signature[8];
+	uint32_t sequence;
+	uint16_t count;
+	uint16_t blocks[DESC_MAX_BLOCKS];
+} __attribute__((packed));
+
+struct commit {
+	char signature[8];
+	uint32_t sequence;
+	uint32_t checksum;	// of the descriptor and the logged blocks
+	uint8_t padding[BLOCK_SIZE - 16];
+} __attribute__((packed));
+
+/* Journal instance description */
+struct journal {
+	/* Disk and journal region */
+	struct disk *disk;
+	size_t start;
+	size_t nblocks;
+	/* Sequence number of the last transaction */
+	uint32_t sequence;
+	/* Transaction headers, kept around to avoid allocations on commit */
+	struct descriptor desc;
+	struct commit commit;
+};
+
+/* FNV-1a hash of @len bytes of @data, continuing from @hash */
+static uint32_t checksum(uint32_t hash, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static size_t capacity(size_t nblocks)
+{
+	size_t cap = nblocks - 2;
+
+	return cap < DESC_MAX_BLOCKS ? cap : DESC_MAX_BLOCKS;
+}
+
+int journal_format(struct disk *disk, size_t start, size_t nblocks)
+{
+	struct descriptor desc;
+
+	if (nblocks < 3) {
+		journal_error("journal region too small (%zu blocks)", nblocks);
+		return -1;
+	}
+
+	memset(&desc, 0, sizeof(desc));
+	memcpy(desc.signature, DESC_SIGNATURE, 8);
+
+	return disk_write_range(disk, start, 1, &desc);
+}
+
+/* Replay the transaction described by @journal->desc, if it is complete */
+static int replay(struct journal *journal)
+{
+	struct descriptor *desc = &journal->desc;
+	struct commit *commit = &journal->commit;
+	size_t count = desc->count;
+	uint32_t hash;
+	uint8_t *data;
+
+	if (count > capacity(journal->nblocks))
+		return 0;
+
+	data = malloc(count * BLOCK_SIZE);
+	if (!data) {
+		journal_error("cannot allocate %zu blocks", count);
+		return -1;
+	}
+
+	if (disk_read_range(journal->disk, journal->start + 1, count, data)
+	    || disk_read_range(journal->disk, journal->start + 1 + count, 1,
+			       commit)) {
+		free(data);
+		return -1;
+	}
+
+	hash = checksum(2166136261u, desc, BLOCK_SIZE);
+	hash = checksum(hash, data, count * BLOCK_SIZE);
+
+	/* Incomplete transaction: its blocks never reached their home */
+	if (memcmp(commit->signature, COMMIT_SIGNATURE, 8)
+	    || commit->sequence != desc->sequence || commit->checksum != hash) {
+		free(data);
+		return 0;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (disk_write_range(journal->disk, desc->blocks[i], 1,
+				     data + i * BLOCK_SIZE)) {
+			free(data);
+			return -1;
+		}
+	}
+
+	free(data);
+	return 0;
+}
+
+struct journal *journal_open(struct disk *disk, size_t start, size_t nblocks)
+{
+	struct journal *journal;
+
+	if (nblocks < 3) {
+		journal_error("journal region too small (%zu blocks)", nblocks);
+		return NULL;
+	}
+
+	journal = calloc(1, sizeof(*journal));
+	if (!journal)
+		return NULL;
+
+	journal->disk = disk;
+	journal->start = start;
+	journal->nblocks = nblocks;
+
+	if (disk_read_range(disk, start, 1, &journal->desc)) {
+		free(journal);
+		return NULL;
+	}
+
+	/* An unformatted region is considered empty */
+	if (memcmp(journal->desc.signature, DESC_SIGNATURE, 8))
+		return journal;
+
+	journal->sequence = journal->desc.sequence;
+	if (journal->desc.count && replay(journal)) {
+		free(journal);
+		return NULL;
+	}
+
+	return journal;
+}
+
+int journal_close(struct journal *journal, int clean)
+{
+	int ret = 0;
+
+	if (clean) {
+		memset(&journal->desc, 0, sizeof(journal->desc));
+		memcpy(journal->desc.signature, DESC_SIGNATURE, 8);
+		journal->desc.sequence = journal->sequence;
+		ret = disk_write_range(journal->disk, journal->start, 1,
+				       &journal->desc);
+	}
+
+	free(journal);
+	return ret;
+}
+
+size_t journal_capacity(struct journal *journal)
+{
+	return capacity(journal->nblocks);
+}
+
+int journal_commit(struct journal *journal, const struct journal_block *blocks,
+		   size_t count)
+{
+	struct descriptor *desc = &journal->desc;
+	struct commit *commit = &journal->commit;
+	struct iovec *iov;
+	uint32_t hash;
+	int ret;
+
+	if (count > capacity(journal->nblocks)) {
+		journal_error("transaction too large (%zu blocks)", count);
+		return -1;
+	}
+
+	iov = malloc((count + 2) * sizeof(*iov));
+	if (!iov)
+		return -1;
+
+	journal->sequence++;
+
+	memset(desc, 0, sizeof(*desc));
+	memcpy(desc->signature, DESC_SIGNATURE, 8);
+	desc->sequence = journal->sequence;
+	desc->count = count;
+	for (size_t i = 0; i < count; i++)
+		desc->blocks[i] = blocks[i].block;
+
+	hash = checksum(2166136261u, desc, BLOCK_SIZE);
+	for (size_t i = 0; i < count; i++)
+		hash = checksum(hash, blocks[i].data, BLOCK_SIZE);
+
+	memset(commit, 0, sizeof(*commit));
+	memcpy(commit->signature, COMMIT_SIGNATURE, 8);
+	commit->sequence = journal->sequence;
+	commit->checksum = hash;
+
+	/* Descriptor, logged blocks and commit record in one request */
+	iov[0].iov_base = desc;
+	iov[0].iov_len = BLOCK_SIZE;
+	for (size_t i = 0; i < count; i++) {
+		iov[i + 1].iov_base = (void *)blocks[i].data;
+		iov[i + 1].iov_len = BLOCK_SIZE;
+	}
+	iov[count + 1].iov_base = commit;
+	iov[count + 1].iov_len = BLOCK_SIZE;
+
+	ret = disk_writev(journal->disk, journal->start, iov, count + 2);
+	free(iov);
+
+	return ret;
+}
@@ -0,0 +1,84 @@
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <stddef.h> /* for size_t definition */
+
+#include "disk.h"
+
+/** Metadata block to be logged in a transaction */
+struct journal_block {
+	/* Index of the block on disk */
+	size_t block;
+	/* New content of the block (%BLOCK_SIZE bytes) */
+	const void *data;
+};
+
+/* Opaque journal instance */
+struct journal;
+
+/**
+ * journal_format - Initialize a journal region
+ * @disk: Disk instance
+ * @start: Index of the first block of the journal region
+ * @nblocks: Number of blocks in the journal region
+ *
+ * Write an empty journal in blocks @start to @start + @nblocks - 1 of virtual
+ * disk @disk.
+ *
+ * Return: -1 if the region is too small or cannot be written. 0 otherwise.
+ */
+int journal_format(struct disk *disk, size_t start, size_t nblocks);
+
+/**
+ * journal_open - Open the journal of a disk
+ * @disk: Disk instance
+ * @start: Index of the first block of the journal region
+ * @nblocks: Number of blocks in the journal region
+ *
+ * If the journal holds a complete transaction, its blocks are copied again to
+ * their home location on disk, so that an interrupted checkpoint completes.
+ * Incomplete transactions are ignored.
+ *
+ * Return: NULL if the journal cannot be read, or if replaying it fails. The
+ * journal instance otherwise.
+ */
+struct journal *journal_open(struct disk *disk, size_t start, size_t nblocks);
+
+/**
+ * journal_close - Close a journal
+ * @journal: Journal
+ * @clean: Whether all the logged transactions have been checkpointed
+ *
+ * When @clean is set, the journal is emptied on disk so that nothing gets
+ * replayed by the next journal_open().
+ *
+ * Return: -1 if emptying the journal fails. 0 otherwise.
+ */
+int journal_close(struct journal *journal, int clean);
+
+/**
+ * journal_capacity - Get the maximum size of a transaction
+ * @journal: Journal
+ *
+ * Return: the maximum number of blocks a transaction can hold.
+ */
+size_t journal_capacity(struct journal *journal);
+
+/**
+ * journal_commit - Log a transaction
+ * @journal: Journal
+ * @blocks: Blocks modified by the transaction
+ * @count: Number of blocks in @blocks
+ *
+ * Write a descriptor of the transaction, the content of the @count blocks and a
+ * checksummed commit record in the journal, with a single request. Once this
+ * returns, the blocks can be written to their home location: if this gets
+ * interrupted, the transaction is replayed by the next journal_open().
+ *
+ * Return: -1 if @count exceeds the journal capacity, or if the journal cannot
+ * be written. 0 otherwise.
+ */
+int journal_commit(struct journal *journal, const struct journal_block *blocks,
+		   size_t count);
+
+#endif /* _JOURNAL_H */
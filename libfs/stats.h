@@ -0,0 +1,96 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Instrumentation helpers. Counters and histograms are updated with relaxed
+ * atomic operations, so that they can be shared by threads without locks.
+ * Without FS_STATS (i.e., `make STATS=0`), they compile to nothing.
+ */
+
+/** Number of buckets of a latency histogram */
+#define STATS_BUCKETS 32
+
+/**
+ * struct stats_histogram - Log-bucketed latency histogram
+ * @count: Number of durations recorded
+ * @total_ns: Sum of the durations recorded, in nanoseconds
+ * @buckets: Bucket i counts the durations of [2^i, 2^(i+1)) nanoseconds. The
+ * first one also counts shorter durations, and the last one longer durations.
+ */
+struct stats_histogram {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t buckets[STATS_BUCKETS];
+};
+
+/**
+ * struct stats_timer - Pending measure of a duration
+ * @hist: Histogram to record the duration in, or NULL
+ * @start: When the measure started, in nanoseconds
+ */
+struct stats_timer {
+	struct stats_histogram *hist;
+	uint64_t start;
+};
+
+/* Current time, in nanoseconds */
+static inline uint64_t stats_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef FS_STATS
+
+/** Add @n to counter @counter */
+#define stats_add(counter, n) \
+	__atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+
+/** Read counter @counter */
+#define stats_read(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+/* Record in @hist the time elapsed since @start */
+static inline void stats_record(struct stats_histogram *hist, uint64_t start)
+{
+	uint64_t ns = stats_clock() - start;
+	int bucket = ns > 1 ? 63 - __builtin_clzll(ns) : 0;
+
+	if (bucket >= STATS_BUCKETS)
+		bucket = STATS_BUCKETS - 1;
+
+	stats_add(hist->count, 1);
+	stats_add(hist->total_ns, ns);
+	stats_add(hist->buckets[bucket], 1);
+}
+
+static inline void stats_timer_stop(struct stats_timer *timer)
+{
+	if (timer->hist)
+		stats_record(timer->hist, timer->start);
+}
+
+/**
+ * STATS_TIMER - Time the rest of the enclosing scope
+ * @hist: Histogram to record the duration in, or NULL
+ *
+ * The duration is recorded whichever way the scope is left (e.g., by any of
+ * the returns of a function).
+ */
+#define STATS_TIMER(hist)						\
+	struct stats_timer stats_timer					\
+	__attribute__((cleanup(stats_timer_stop))) = { (hist), stats_clock() }
+
+#else /* !FS_STATS */
+
+#define stats_add(counter, n) ((void)0)
+#define stats_read(counter) ((void)(counter), 0)
+#define STATS_TIMER(hist) ((void)0)
+
+#endif /* FS_STATS */
+
+#endif /* _STATS_H */
@@ -0,0 +1,119 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define trace_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/* Size of the record buffer */
+#define TRACE_BUFFER_SIZE (64 * 1024)
+
+/* Trace instance description */
+struct trace {
+	int fd;
+	pthread_mutex_t lock;
+	/* Records not written yet */
+	char buf[TRACE_BUFFER_SIZE];
+	size_t used;
+	/* Whether a write failed, in which case the following records are lost */
+	int failed;
+};
+
+/* Write @len bytes of @buf to the file of @trace, with the lock held */
+static void write_out(struct trace *trace, const char *buf, size_t len)
+{
+	while (len > 0 && !trace->failed) {
+		ssize_t ret = write(trace->fd, buf, len);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("write");
+			trace->failed = 1;
+			break;
+		}
+		buf += ret;
+		len -= ret;
+	}
+}
+
+static void flush(struct trace *trace)
+{
+	write_out(trace, trace->buf, trace->used);
+	trace->used = 0;
+}
+
+struct trace *trace_open(const char *filename, const void *header, size_t len)
+{
+	struct trace *trace;
+
+	if (!filename) {
+		trace_error("invalid trace filename");
+		return NULL;
+	}
+
+	trace = malloc(sizeof(*trace));
+	if (!trace) {
+		perror("malloc");
+		return NULL;
+	}
+
+	trace->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (trace->fd < 0) {
+		perror("open");
+		free(trace);
+		return NULL;
+	}
+
+	pthread_mutex_init(&trace->lock, NULL);
+	trace->used = 0;
+	trace->failed = 0;
+	trace_append(trace, header, len, NULL, 0);
+
+	return trace;
+}
+
+void trace_append(struct trace *trace, const void *rec, size_t len,
+		  const void *data, size_t data_len)
+{
+	pthread_mutex_lock(&trace->lock);
+
+	if (trace->used + len + data_len > TRACE_BUFFER_SIZE)
+		flush(trace);
+
+	/* Records larger than the buffer bypass it */
+	if (len + data_len > TRACE_BUFFER_SIZE) {
+		write_out(trace, rec, len);
+		write_out(trace, data, data_len);
+	} else {
+		memcpy(trace->buf + trace->used, rec, len);
+		if (data_len)
+			memcpy(trace->buf + trace->used + len, data, data_len);
+		trace->used += len + data_len;
+	}
+
+	pthread_mutex_unlock(&trace->lock);
+}
+
+int trace_close(struct trace *trace)
+{
+	int ret;
+
+	flush(trace);
+	ret = trace->failed ? -1 : 0;
+
+	if (close(trace->fd)) {
+		perror("close");
+		ret = -1;
+	}
+	pthread_mutex_destroy(&trace->lock);
+	free(trace);
+
+	return ret;
+}
@@ -0,0 +1,45 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stddef.h> /* for size_t definition */
+
+/*
+ * Opaque trace file writer. Records are buffered in memory and appended to the
+ * file in large writes. Every operation is thread-safe.
+ */
+struct trace;
+
+/**
+ * trace_open - Create a trace file
+ * @filename: Name of the host file, created or truncated
+ * @header: Header written at the beginning of the file
+ * @len: Length of @header in bytes
+ *
+ * Return: NULL if the file cannot be created or memory cannot be allocated.
+ * The trace instance otherwise.
+ */
+struct trace *trace_open(const char *filename, const void *header, size_t len);
+
+/**
+ * trace_append - Append a record to a trace file
+ * @trace: Trace instance
+ * @rec: Fixed-size part of the record
+ * @len: Length of @rec in bytes
+ * @data: Variable-size part of the record, or NULL
+ * @data_len: Length of @data in bytes
+ *
+ * The two parts are appended together, so that the records of concurrent
+ * callers do not interleave. Write errors are reported by trace_close().
+ */
+void trace_append(struct trace *trace, const void *rec, size_t len,
+		  const void *data, size_t data_len);
+
+/**
+ * trace_close - Write the buffered records and close a trace file
+ * @trace: Trace instance
+ *
+ * Return: -1 if a record could not be written. 0 otherwise.
+ */
+int trace_close(struct trace *trace);
+
+#endif /* _TRACE_H */